@@ -0,0 +1,275 @@
+// Replays candump / ASC logs through the virtual CAN bus and the firmware RX path
+// Usage: can_replay [--realtime] [--filter 197,55E] [--tx-log out.log] log [log...]
+//
+// Each received frame goes through the same steps as can_rx_task in main.c
+// (serial forwarding with throttling, 0x197 decode, state report), and every
+// gear display change is transmitted back on the bus so it shows up in the
+// TX capture. M-mode shifts are played back through the same shift queue as
+// on the device, on log time: the app clock (app_clock.h) is virtual and follows the
+// frame timestamps, so the throttles and the shifter-loss timeout behave as on the
+// device however fast the replay runs. The report compares the achieved RX rate with
+// the frame rate of a fully loaded 500 kbit/s bus carrying the same ID/DLC mix. With --filter the
+// CAN HAL whitelist is applied as on the device and per-ID counters are printed.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "can_hal.h"
+#include "bmw_shifter.h"
+#include "serial_protocol.h"
+#include "shift_queue.h"
+#include "app_clock.h"
+#include "shifter_link.h"
+#include "can_loadgen.h"
+
+#define CAN_BITRATE             500000u
+#define SHIFT_PULSE_US          80000u   // Same pulse and gap as hid_update_task
+#define SHIFT_GAP_US            20000u
+
+static bmw_shifter_state_t shifter_state;
+static shifter_link_t shifter_link;     // Same throttles and loss timeout as can_rx_task
+static shift_queue_t shift_fifo;
+static const gear_display_msg_t gear_display_template = {0, 0x00, GEAR_IND_P, 0x0C, 0xFF};
+static const uint8_t gear_display_variants[] = {GEAR_IND_P, GEAR_IND_R, GEAR_IND_N, 0x80, GEAR_IND_D};
+static uint8_t gear_display_frames[sizeof(gear_display_variants)][BMW_COUNTER_MODULO][sizeof(gear_display_msg_t)];
+static bmw_tx_cache_t gear_display_cache = {
+    .can_id = CAN_ID_DISPLAY_GEAR,
+    .template_data = (const uint8_t *)&gear_display_template,
+    .len = sizeof(gear_display_msg_t),
+    .variant_byte = offsetof(gear_display_msg_t, gear_indication),
+    .variants = gear_display_variants,
+    .variant_count = sizeof(gear_display_variants),
+    .frames = &gear_display_frames[0][0][0],
+};
+
+// Parse a comma separated list of hex IDs into the CAN HAL whitelist
+static bool set_filter_from_list(const char *list) {
+    uint32_t ids[CAN_HAL_FILTER_MAX_IDS];
+    size_t count = 0;
+    while (*list != '\0') {
+        char *end;
+        unsigned long id = strtoul(list, &end, 16);
+        if (end == list || count == CAN_HAL_FILTER_MAX_IDS) {
+            return false;
+        }
+        ids[count++] = (uint32_t)id;
+        list = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            return false;
+        }
+    }
+    return can_hal_set_filter(ids, count);
+}
+
+static int compare_id_stats(const void *a, const void *b) {
+    uint32_t x = ((const can_hal_id_stats_t *)a)->id;
+    uint32_t y = ((const can_hal_id_stats_t *)b)->id;
+    return (x > y) - (x < y);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t frame_bits(const can_frame_t *frame) {
+    return can_loadgen_frame_bits(frame->dlc, (frame->flags & CAN_FRAME_FLAG_EXTD) != 0);
+}
+
+static void transmit_gear_display(uint8_t gear_ind) {
+    const uint8_t *frame = bmw_tx_cache_next(&gear_display_cache, gear_ind);
+    if (frame == NULL) {
+        return;
+    }
+
+    can_frame_t msg = {
+        .id = CAN_ID_DISPLAY_GEAR,
+        .dlc = sizeof(gear_display_msg_t),
+    };
+    memcpy(msg.data, frame, sizeof(gear_display_msg_t));
+    can_hal_transmit(&msg, 10);
+}
+
+// Mirror of the per-frame work in can_rx_task
+static void process_frame(const can_frame_t *frame, uint32_t *lever_frames) {
+    static uint8_t last_gear_ind = 0;
+    uint64_t now = (uint64_t)app_clock_now_us();
+    shift_queue_item_t shift;
+
+    // Shifts due by now are played before this frame, as the HID task would have
+    while (shift_queue_next(&shift_fifo, now, &shift)) {
+    }
+
+    // Gaps the device would have reported as a lost shifter are counted when the next frame arrives
+    shifter_link_frame_seen(&shifter_link, frame->id);
+    if (shifter_link_should_forward(&shifter_link, frame->id)) {
+        serial_send_can_rx((uint16_t)frame->id, frame->data, frame->dlc, (uint32_t)now);
+    }
+
+    if (frame->id == CAN_ID_GEAR_LEVER_POSITION && frame->dlc >= 4) {
+        (*lever_frames)++;
+        shift_queue_push(&shift_fifo, bmw_process_lever_position(&shifter_state, frame->data[2], frame->data[3]),
+                         (int64_t)now);
+
+        if (shifter_link_should_send_state(&shifter_link)) {
+            serial_send_shifter_state(&shifter_state, (uint32_t)now);
+        }
+
+        uint8_t gear_ind = bmw_get_gear_indication(shifter_state.current_gear);
+        if (shifter_state.current_gear == GEAR_M && shifter_state.lever_position == LEVER_POS_CENTER_SIDE) {
+            gear_ind = 0x81;
+        }
+        if (gear_ind != last_gear_ind) {
+            transmit_gear_display(gear_ind);
+            last_gear_ind = gear_ind;
+        }
+    }
+}
+
+static bool write_tx_log(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return false;
+    }
+    const can_frame_t *frames = can_virtual_tx_frames();
+    for (size_t i = 0; i < can_virtual_tx_count(); i++) {
+        fprintf(f, "(%llu.%06llu) vcan0 %03X#",
+                (unsigned long long)(frames[i].timestamp_us / 1000000ull),
+                (unsigned long long)(frames[i].timestamp_us % 1000000ull),
+                (unsigned)frames[i].id);
+        for (uint8_t b = 0; b < frames[i].dlc; b++) {
+            fprintf(f, "%02X", frames[i].data[b]);
+        }
+        fputc('\n', f);
+    }
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    const char *tx_log = NULL;
+    bool filtered = false;
+    can_virtual_pace_t pace = CAN_VIRTUAL_PACE_MAX_SPEED;
+    int argi = 1;
+
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (strcmp(argv[argi], "--realtime") == 0) {
+            pace = CAN_VIRTUAL_PACE_REALTIME;
+        } else if (strcmp(argv[argi], "--filter") == 0 && argi + 1 < argc) {
+            if (!set_filter_from_list(argv[++argi])) {
+                fprintf(stderr, "bad --filter list (up to %d hex IDs <= 7FF)\n", CAN_HAL_FILTER_MAX_IDS);
+                return 1;
+            }
+            filtered = true;
+        } else if (strcmp(argv[argi], "--tx-log") == 0 && argi + 1 < argc) {
+            tx_log = argv[++argi];
+        } else {
+            break;
+        }
+    }
+    if (argi >= argc) {
+        fprintf(stderr, "usage: %s [--realtime] [--filter 197,55E] [--tx-log out.log] log [log...]\n", argv[0]);
+        return 1;
+    }
+
+    can_hal_set_backend(&can_hal_virtual_backend);
+    can_virtual_reset();
+    for (; argi < argc; argi++) {
+        if (!can_virtual_load_log(argv[argi])) {
+            fprintf(stderr, "failed to load %s\n", argv[argi]);
+            return 1;
+        }
+    }
+    can_virtual_set_pace(pace);
+    can_hal_reset_stats();
+    bmw_shifter_init(&shifter_state);
+    shifter_link_init(&shifter_link);
+    bmw_tx_cache_init(&gear_display_cache);
+    shift_queue_init(&shift_fifo, SHIFT_PULSE_US, SHIFT_GAP_US);
+    app_clock_use_virtual(0);
+
+    // Protocol output is part of the measured work but not of the report
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    if (report == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        perror("stdout redirect");
+        return 1;
+    }
+
+    size_t total = can_virtual_rx_pending();
+    size_t delivered = 0;
+    uint64_t bus_bits = 0;
+    uint64_t log_span_us = 0;
+    uint32_t lever_frames = 0;
+    can_frame_t frame;
+
+    uint64_t start = now_ns();
+    while (can_virtual_rx_pending() > 0) {
+        if (can_hal_receive(&frame, 100) != CAN_HAL_OK) {
+            continue;
+        }
+        delivered++;
+        bus_bits += frame_bits(&frame);
+        log_span_us = frame.timestamp_us;
+        app_clock_set_us((int64_t)frame.timestamp_us);
+        process_frame(&frame, &lever_frames);
+    }
+    fflush(stdout);
+    uint64_t elapsed_ns = now_ns() - start;
+
+    double elapsed_s = (double)elapsed_ns / 1e9;
+    double rx_fps = elapsed_s > 0.0 ? (double)total / elapsed_s : 0.0;
+    // With --filter only delivered frames are seen, so bus figures cover the whitelisted IDs
+    double avg_bits = delivered ? (double)bus_bits / (double)delivered : 0.0;
+    double full_load_fps = avg_bits > 0.0 ? (double)CAN_BITRATE / avg_bits : 0.0;
+    double log_load = log_span_us ? 100.0 * (double)bus_bits / ((double)log_span_us * CAN_BITRATE / 1e6) : 0.0;
+
+    fprintf(report, "backend:            %s (%s)\n", can_hal_get_backend()->name,
+            pace == CAN_VIRTUAL_PACE_REALTIME ? "realtime" : "max speed");
+    fprintf(report, "frames:             %zu (0x197: %u)\n", total, lever_frames);
+    fprintf(report, "log span:           %.3f s, bus load %.1f%% at 500 kbit/s%s\n", (double)log_span_us / 1e6, log_load,
+            filtered ? " (whitelisted IDs)" : "");
+    fprintf(report, "replay time:        %.3f s\n", elapsed_s);
+    fprintf(report, "RX path rate:       %.0f frames/s (%.1f ns/frame)\n", rx_fps,
+            total ? (double)elapsed_ns / (double)total : 0.0);
+    fprintf(report, "100%% load rate:     %.0f frames/s (avg %.1f bits/frame, worst-case stuffing)\n",
+            full_load_fps, avg_bits);
+    if (full_load_fps > 0.0 && pace == CAN_VIRTUAL_PACE_MAX_SPEED) {
+        fprintf(report, "headroom:           %.1fx\n", rx_fps / full_load_fps);
+    }
+    fprintf(report, "TX frames captured: %zu\n", can_virtual_tx_count());
+    shift_queue_stats_t shifts;
+    shift_queue_get_stats(&shift_fifo, &shifts);
+    fprintf(report, "manual shifts:      %u queued, %u played, %u dropped, %zu still pending at log end\n",
+            shifts.queued, shifts.played, shifts.dropped, shifts.pending);
+    fprintf(report, "shifter lost:       %u times (no 0x197/0x55E for %d ms)\n", shifter_link.losses,
+            TIMING_SHIFTER_LOSS_MS);
+    if (filtered) {
+        can_hal_id_stats_t stats[CAN_HAL_STATS_SLOTS];
+        uint32_t untracked = 0;
+        size_t count = can_hal_get_id_stats(stats, CAN_HAL_STATS_SLOTS, &untracked);
+        qsort(stats, count, sizeof(stats[0]), compare_id_stats);
+        fprintf(report, "filter:             %zu of %zu frames delivered\n", delivered, total);
+        fprintf(report, "    id   accepted   rejected\n");
+        for (size_t i = 0; i < count; i++) {
+            fprintf(report, "   %03X %10u %10u\n", (unsigned)stats[i].id, stats[i].accepted, stats[i].rejected);
+        }
+        if (untracked > 0) {
+            fprintf(report, "   (%u frames of IDs beyond the %d counter slots)\n", untracked, CAN_HAL_STATS_SLOTS);
+        }
+    }
+
+    if (tx_log != NULL && !write_tx_log(tx_log)) {
+        fprintf(stderr, "failed to write %s\n", tx_log);
+        return 1;
+    }
+    fclose(report);
+    can_virtual_reset();
+    return 0;
+}
@@ -0,0 +1,327 @@
+// Bus-load stress test of the RX path on a synthetic PT-CAN
+// Usage: can_stress [--load 0-100] [--duration s] [--mix ID:DLC:MS,...] [--jitter-us N] [--seed N]
+//                   [--sniffer] [--queue N] [--cost-us N] [--stall MS/EVERY_MS] [--late-ms N]
+//                   [--candump out.log]
+//
+// can_loadgen.h puts a genuine shifter (0x197 lever script + 0x55E) on a bus filled
+// with background traffic up to the requested load at 500 kbit/s. The receive side
+// is modelled like the device: the acceptance filter (0x197/0x55E unless --sniffer),
+// an RX queue of --queue frames that counts overruns like TWAI rx_missed_count, and
+// can_rx_task taking --cost-us per frame, optionally stalled for MS every EVERY_MS by
+// higher-priority work. Every run is on virtual time and deterministic for a seed.
+//
+// End-to-end checks: each delivered 0x197 goes through bmw_verify_pkt (counter gaps,
+// as the device sees lost frames) and bmw_process_lever_position, and the resulting
+// gear must match a reference shifter state fed with every 0x197 on the wire.
+// --candump writes the generated traffic for canplayer, to load a real rig the same
+// way and read the device's own counters ("CAN RX lost", "0x197 ... counter gaps").
+// Exit status 2 if any 0x197 frame was lost or the state diverged.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "can_hal.h"
+#include "can_loadgen.h"
+#include "bmw_shifter.h"
+#include "latency_probe.h"
+#include "app_clock.h"
+
+#define RX_QUEUE_LEN        32      // Same as TWAI_RX_QUEUE_LEN in can_hal_twai.c
+#define RX_QUEUE_MAX        1024
+#define DEFAULT_COST_US     50
+#define DEFAULT_LATE_MS     5
+
+typedef struct {
+    can_loadgen_event_t event;
+    bmw_gear_t ref_gear;         // Reference state after this frame (0x197 only)
+    uint8_t ref_manual_gear;
+} rx_entry_t;
+
+static rx_entry_t rx_queue[RX_QUEUE_MAX];
+static size_t rx_head = 0;
+static size_t rx_count = 0;
+static size_t rx_capacity = RX_QUEUE_LEN;
+
+static uint32_t cost_us = DEFAULT_COST_US;
+static uint32_t stall_us = 0;
+static uint32_t stall_every_us = 0;
+static uint64_t rx_busy_until = 0;
+
+static bmw_shifter_state_t ref_state;
+static bmw_shifter_state_t dev_state;
+static uint32_t ref_shifts = 0;
+static uint32_t dev_shifts = 0;
+static uint32_t lever_on_wire = 0;
+static uint32_t lever_processed = 0;
+static uint32_t lever_queue_full = 0;
+static uint32_t lever_counter_gaps = 0;
+static uint32_t lever_crc_errors = 0;
+static uint32_t lever_late = 0;
+static uint32_t state_mismatches = 0;
+static uint64_t late_us = DEFAULT_LATE_MS * 1000u;
+static can_hal_rx_loss_t rx_loss;
+static latency_probe_t bus_delay = LATENCY_PROBE_INITIALIZER;
+static latency_probe_t rx_delay = LATENCY_PROBE_INITIALIZER;
+
+// Parse "ID:DLC:MS,..." into background streams
+static size_t parse_mix(const char *list, can_loadgen_stream_t *streams) {
+    size_t count = 0;
+    while (*list != '\0' && count < CAN_LOADGEN_MAX_STREAMS) {
+        unsigned id;
+        unsigned dlc;
+        double period_ms;
+        int used = 0;
+        if (sscanf(list, "%x:%u:%lf%n", &id, &dlc, &period_ms, &used) != 3 || dlc > 8 || period_ms <= 0.0) {
+            return 0;
+        }
+        streams[count].id = id;
+        streams[count].dlc = (uint8_t)dlc;
+        streams[count].period_us = (uint32_t)(period_ms * 1000.0);
+        count++;
+        list += used;
+        if (*list == ',') {
+            list++;
+        } else if (*list != '\0') {
+            return 0;
+        }
+    }
+    return *list == '\0' ? count : 0;
+}
+
+// When can_rx_task can take the next frame: not busy and not stalled
+static uint64_t rx_start_time(uint64_t ready_us) {
+    uint64_t start = ready_us > rx_busy_until ? ready_us : rx_busy_until;
+    if (stall_us > 0 && start % stall_every_us < stall_us) {
+        start += stall_us - start % stall_every_us;
+    }
+    return start;
+}
+
+// can_rx_task handles one frame
+static void rx_process(const rx_entry_t *entry, uint64_t start_us) {
+    const can_frame_t *frame = &entry->event.frame;
+    app_clock_set_us((int64_t)start_us);
+    rx_busy_until = start_us + cost_us;
+    if (!entry->event.lever || frame->dlc < 4) {
+        return;
+    }
+
+    lever_processed++;
+    // From the end of the frame on the wire: RX queue and task delay only, not arbitration
+    latency_probe_record(&rx_delay, (int64_t)frame->timestamp_us, (int64_t)start_us);
+    if (start_us - frame->timestamp_us > late_us) {
+        lever_late++;
+    }
+    bmw_pkt_status_t status = bmw_verify_pkt((uint16_t)frame->id, frame->data, frame->dlc);
+    if (status == BMW_PKT_BAD_CRC) {
+        lever_crc_errors++;
+    } else if (status == BMW_PKT_COUNTER_SKIP) {
+        lever_counter_gaps++;
+    }
+    if (bmw_process_lever_position(&dev_state, frame->data[2], frame->data[3]) != BMW_MANUAL_NONE) {
+        dev_shifts++;
+    }
+    if (dev_state.current_gear != entry->ref_gear || dev_state.manual_gear != entry->ref_manual_gear) {
+        state_mismatches++;
+    }
+}
+
+// Let can_rx_task work through the queue up to time now_us
+static void rx_drain(uint64_t now_us) {
+    while (rx_count > 0) {
+        const rx_entry_t *head = &rx_queue[rx_head];
+        uint64_t start = rx_start_time(head->event.frame.timestamp_us);
+        if (start > now_us) {
+            break;
+        }
+        rx_process(head, start);
+        rx_head = (rx_head + 1) % rx_capacity;
+        rx_count--;
+    }
+}
+
+static void rx_deliver(const can_loadgen_event_t *event) {
+    rx_drain(event->frame.timestamp_us);
+    if (rx_count == rx_capacity) {
+        rx_loss.queue_full++;
+        if (event->lever) {
+            lever_queue_full++;
+        }
+        return;
+    }
+    rx_entry_t *entry = &rx_queue[(rx_head + rx_count) % rx_capacity];
+    entry->event = *event;
+    entry->ref_gear = ref_state.current_gear;
+    entry->ref_manual_gear = ref_state.manual_gear;
+    rx_count++;
+}
+
+static void write_candump(FILE *f, const can_frame_t *frame) {
+    fprintf(f, "(%llu.%06llu) can0 %03X#", (unsigned long long)(frame->timestamp_us / 1000000ull),
+            (unsigned long long)(frame->timestamp_us % 1000000ull), (unsigned)frame->id);
+    for (uint8_t i = 0; i < frame->dlc; i++) {
+        fprintf(f, "%02X", frame->data[i]);
+    }
+    fputc('\n', f);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--load 0-100] [--duration s] [--mix ID:DLC:MS,...] [--jitter-us N] [--seed N]\n"
+                    "       [--sniffer] [--queue N] [--cost-us N] [--stall MS/EVERY_MS] [--late-ms N]\n"
+                    "       [--candump out.log]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    can_loadgen_config_t config = {
+        .bitrate = CAN_LOADGEN_BITRATE,
+        .load_percent = 90,
+        .jitter_us = 200,
+        .seed = 1,
+    };
+    can_loadgen_stream_t mix[CAN_LOADGEN_MAX_STREAMS];
+    double duration_s = 60.0;
+    bool sniffer = false;
+    const char *candump_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--sniffer") == 0) {
+            sniffer = true;
+            continue;
+        }
+        if (value == NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+        if (strcmp(arg, "--load") == 0) {
+            char *end;
+            unsigned long load = strtoul(value, &end, 10);
+            if (*value == '\0' || *value == '-' || *end != '\0' || load > 100) {
+                usage(argv[0]);
+                return 1;
+            }
+            config.load_percent = (uint8_t)load;
+        } else if (strcmp(arg, "--duration") == 0) {
+            duration_s = atof(value);
+        } else if (strcmp(arg, "--mix") == 0) {
+            config.stream_count = parse_mix(value, mix);
+            if (config.stream_count == 0) {
+                fprintf(stderr, "bad --mix (up to %d entries of hex ID:DLC:period ms)\n", CAN_LOADGEN_MAX_STREAMS);
+                return 1;
+            }
+            config.streams = mix;
+        } else if (strcmp(arg, "--jitter-us") == 0) {
+            config.jitter_us = (uint32_t)strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--seed") == 0) {
+            config.seed = (uint32_t)strtoul(value, NULL, 0);
+        } else if (strcmp(arg, "--queue") == 0) {
+            rx_capacity = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--cost-us") == 0) {
+            cost_us = (uint32_t)strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--stall") == 0) {
+            unsigned stall_ms;
+            unsigned every_ms;
+            if (sscanf(value, "%u/%u", &stall_ms, &every_ms) != 2 || stall_ms >= every_ms) {
+                fprintf(stderr, "bad --stall, expected MS/EVERY_MS with MS < EVERY_MS\n");
+                return 1;
+            }
+            stall_us = stall_ms * 1000u;
+            stall_every_us = every_ms * 1000u;
+        } else if (strcmp(arg, "--late-ms") == 0) {
+            late_us = strtoull(value, NULL, 10) * 1000u;
+        } else if (strcmp(arg, "--candump") == 0) {
+            candump_path = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (rx_capacity == 0 || rx_capacity > RX_QUEUE_MAX || duration_s <= 0.0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    can_loadgen_t gen;
+    if (!can_loadgen_init(&gen, &config)) {
+        fprintf(stderr, "bad load generator configuration (load 0-100, IDs <= 7FF other than 197/55E)\n");
+        return 1;
+    }
+    FILE *candump = NULL;
+    if (candump_path != NULL && (candump = fopen(candump_path, "w")) == NULL) {
+        perror(candump_path);
+        return 1;
+    }
+
+    // Device whitelist, as in main.c (empty = sniffer)
+    static const uint32_t device_ids[] = {CAN_ID_GEAR_LEVER_POSITION, CAN_ID_GEAR_LEVER_HEARTBEAT};
+    can_hal_set_filter(device_ids, sniffer ? 0 : 2);
+    bmw_shifter_init(&ref_state);
+    bmw_shifter_init(&dev_state);
+    app_clock_use_virtual(0);
+
+    uint64_t end_us = (uint64_t)(duration_s * 1e6);
+    uint32_t filtered = 0;
+    can_loadgen_event_t event;
+    while (1) {
+        can_loadgen_next(&gen, &event);
+        if (event.frame.timestamp_us > end_us) {
+            break;
+        }
+        if (candump != NULL) {
+            write_candump(candump, &event.frame);
+        }
+        if (event.lever) {
+            lever_on_wire++;
+            latency_probe_record(&bus_delay, (int64_t)event.queued_us, (int64_t)event.frame.timestamp_us);
+            if (bmw_process_lever_position(&ref_state, event.frame.data[2], event.frame.data[3]) != BMW_MANUAL_NONE) {
+                ref_shifts++;
+            }
+        }
+        if (!can_hal_filter_accepts(event.frame.id, event.frame.flags)) {
+            filtered++;
+            continue;
+        }
+        rx_deliver(&event);
+    }
+    rx_drain(UINT64_MAX);
+    if (candump != NULL) {
+        fclose(candump);
+    }
+
+    can_loadgen_stats_t stats;
+    can_loadgen_get_stats(&gen, &stats);
+    uint32_t lever_lost = stats.lever_overwritten + lever_queue_full;
+
+    printf("bus:                %u kbit/s, target %u%%, offered %.1f%%, on the wire %.1f%% over %.3f s\n",
+           (unsigned)(config.bitrate / 1000), config.load_percent, can_loadgen_offered_permille(&gen) / 10.0,
+           100.0 * (double)stats.busy_us / (double)end_us, duration_s);
+    printf("background:         %zu streams, %u frames sent, %u overwritten before arbitration\n",
+           gen.sender_count - 2, stats.other_sent, stats.other_overwritten);
+    printf("0x197 on the wire:  %u sent, %u overwritten before arbitration\n",
+           lever_on_wire, stats.lever_overwritten);
+    printf("bus delay 0x197:    p50 %lu us, p99 %lu us, max %lu us\n",
+           (unsigned long)latency_probe_percentile_us(&bus_delay, 500),
+           (unsigned long)latency_probe_percentile_us(&bus_delay, 990), (unsigned long)bus_delay.max_us);
+    printf("RX path:            %s, queue %zu, %u us/frame", sniffer ? "sniffer" : "filter 197,55E",
+           rx_capacity, cost_us);
+    if (stall_us > 0) {
+        printf(", stalled %u ms every %u ms", stall_us / 1000, stall_every_us / 1000);
+    }
+    printf(", %u frames filtered in hardware\n", filtered);
+    printf("RX queue full:      %u frames (0x197: %u)\n", rx_loss.queue_full, lever_queue_full);
+    printf("0x197 processed:    %u, counter gaps %u, CRC errors %u\n",
+           lever_processed, lever_counter_gaps, lever_crc_errors);
+    printf("due to can_rx_task: p50 %lu us, p99 %lu us, max %lu us, %u later than %llu ms\n",
+           (unsigned long)latency_probe_percentile_us(&rx_delay, 500),
+           (unsigned long)latency_probe_percentile_us(&rx_delay, 990), (unsigned long)rx_delay.max_us,
+           lever_late, (unsigned long long)(late_us / 1000));
+    printf("state check:        %u of %u frames off the reference gear, manual shifts %u of %u\n",
+           state_mismatches, lever_processed, dev_shifts, ref_shifts);
+    printf("0x197 lost:         %u (%.3f%%)\n", lever_lost,
+           lever_on_wire + stats.lever_overwritten ?
+           100.0 * lever_lost / (lever_on_wire + stats.lever_overwritten) : 0.0);
+
+    return lever_lost > 0 || state_mismatches > 0 || dev_shifts != ref_shifts ? 2 : 0;
+}
@@ -0,0 +1,379 @@
+// Host benchmark for the shifter hot path (CAN decode, display packet, serial protocol)
+// Usage: shifter_bench [ops_per_benchmark]
+//
+// Each benchmark is run twice over the same synthetic input:
+//   - a throughput pass without per-op timing (ns/op)
+//   - a latency pass timing every op individually (p50/p99/p999/max)
+// Serial output produced by the benchmarked functions goes to /dev/null,
+// the report is written to the original stdout.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bmw_shifter.h"
+#include "serial_protocol.h"
+#include "ring_buffer.h"
+#include "dlog.h"
+
+#define DEFAULT_OPS      2000000u
+#define FRAME_POOL_SIZE  4096u   // Synthetic frames, power of two
+#define FRAME_POOL_MASK  (FRAME_POOL_SIZE - 1u)
+
+typedef struct {
+    const char *name;
+    void (*setup)(void);
+    void (*run)(uint32_t i);
+} bench_case_t;
+
+// Synthetic input
+static uint8_t lever_frames[FRAME_POOL_SIZE];
+static uint8_t park_frames[FRAME_POOL_SIZE];
+static uint8_t can_frames[FRAME_POOL_SIZE][8];
+static uint16_t can_ids[FRAME_POOL_SIZE];
+
+static const char *const commands[] = {
+    "{\"type\":\"set_backlight\",\"level\":128}",
+    "{\"type\":\"set_gear_indication\",\"gear\":\"D\"}",
+    "{\"type\":\"hid_button\",\"button\":\"+\",\"action\":\"press\"}",
+    "{\"type\":\"hid_button\",\"button\":\"+\",\"action\":\"release\"}",
+};
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+static bmw_shifter_state_t bench_state;
+static gear_display_msg_t bench_display = {0, 0, GEAR_IND_P, 0x0C, 0xFF};
+static const gear_display_msg_t bench_display_template = {0, 0x00, GEAR_IND_P, 0x0C, 0xFF};
+static const uint8_t bench_display_variants[] = {GEAR_IND_P, GEAR_IND_R, GEAR_IND_N, 0x80, GEAR_IND_D};
+static uint8_t bench_display_frames[sizeof(bench_display_variants)][BMW_COUNTER_MODULO][sizeof(gear_display_msg_t)];
+static bmw_tx_cache_t bench_display_cache = {
+    .can_id = CAN_ID_DISPLAY_GEAR,
+    .template_data = (const uint8_t *)&bench_display_template,
+    .len = sizeof(gear_display_msg_t),
+    .variant_byte = offsetof(gear_display_msg_t, gear_indication),
+    .variants = bench_display_variants,
+    .variant_count = sizeof(bench_display_variants),
+    .frames = &bench_display_frames[0][0][0],
+};
+static volatile uint32_t sink;  // Keeps results observable to the optimizer
+
+static uint32_t rng_state = 0x12345678u;
+
+static uint32_t rng_next(void) {
+    // xorshift32 - deterministic input across runs
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Build a plausible lever stream: the lever always passes through its
+// neighbouring positions, like the real shifter reporting every 30 ms
+static void generate_frames(void) {
+    static const uint8_t from_center[] = {
+        LEVER_POS_CENTER_MIDDLE, LEVER_POS_UP_1, LEVER_POS_DOWN_1, LEVER_POS_CENTER_SIDE
+    };
+    static const uint8_t from_side[] = {
+        LEVER_POS_CENTER_SIDE, LEVER_POS_SIDE_UP, LEVER_POS_SIDE_DOWN, LEVER_POS_CENTER_MIDDLE
+    };
+    uint8_t pos = LEVER_POS_CENTER_MIDDLE;
+
+    for (uint32_t i = 0; i < FRAME_POOL_SIZE; i++) {
+        uint32_t r = rng_next();
+        switch (pos) {
+            case LEVER_POS_CENTER_MIDDLE: pos = from_center[r & 3]; break;
+            case LEVER_POS_CENTER_SIDE:   pos = from_side[r & 3]; break;
+            case LEVER_POS_UP_1:          pos = (r & 1) ? LEVER_POS_UP_2 : LEVER_POS_CENTER_MIDDLE; break;
+            case LEVER_POS_DOWN_1:        pos = (r & 1) ? LEVER_POS_DOWN_2 : LEVER_POS_CENTER_MIDDLE; break;
+            case LEVER_POS_SIDE_UP:
+            case LEVER_POS_SIDE_DOWN:     pos = LEVER_POS_CENTER_SIDE; break;
+            default:                      pos = LEVER_POS_CENTER_MIDDLE; break;
+        }
+        lever_frames[i] = pos;
+        park_frames[i] = ((r >> 8) % 64 == 0) ? PARK_BUTTON_PRESSED : PARK_BUTTON_NORMAL;
+
+        can_ids[i] = (r >> 16) % 4 == 0 ? CAN_ID_GEAR_LEVER_HEARTBEAT : CAN_ID_GEAR_LEVER_POSITION;
+        for (int b = 0; b < 8; b++) {
+            can_frames[i][b] = (uint8_t)rng_next();
+        }
+        can_frames[i][2] = pos;
+        can_frames[i][3] = park_frames[i];
+    }
+}
+
+// Benchmarked operations
+static void setup_lever(void) {
+    bmw_shifter_init(&bench_state);
+}
+
+static void run_lever(uint32_t i) {
+    uint32_t idx = i & FRAME_POOL_MASK;
+    sink += bmw_process_lever_position(&bench_state, lever_frames[idx], park_frames[idx]);
+    sink += bench_state.current_gear;
+}
+
+static bmw_state_snapshot_t bench_snapshot;
+
+static void setup_snapshot(void) {
+    bmw_shifter_init(&bench_state);
+    bmw_state_snapshot_init(&bench_snapshot, &bench_state);
+}
+
+static void run_snapshot_publish(uint32_t i) {
+    bench_state.lever_position = lever_frames[i & FRAME_POOL_MASK];
+    bmw_state_snapshot_publish(&bench_snapshot, &bench_state);
+}
+
+static void run_snapshot_read(uint32_t i) {
+    (void) i;
+    bmw_shifter_state_t state;
+    sink += bmw_state_snapshot_read(&bench_snapshot, &state);
+    sink += state.lever_position;
+}
+
+static void run_update_pkt(uint32_t i) {
+    static const uint8_t indications[] = {GEAR_IND_P, GEAR_IND_R, GEAR_IND_N, 0x80, GEAR_IND_D};
+    bench_display.gear_indication = indications[i % sizeof(indications)];
+    bmw_update_pkt(CAN_ID_DISPLAY_GEAR, (uint8_t *)&bench_display, sizeof(bench_display));
+    sink += bench_display.crc;
+}
+
+static void setup_tx_cache(void) {
+    bmw_tx_cache_init(&bench_display_cache);
+}
+
+static void run_tx_cache(uint32_t i) {
+    const uint8_t *frame = bmw_tx_cache_next(&bench_display_cache, bench_display_variants[i % sizeof(bench_display_variants)]);
+    sink += frame[0];
+}
+
+static void run_verify_pkt(uint32_t i) {
+    uint32_t idx = i & FRAME_POOL_MASK;
+    sink += bmw_verify_pkt(CAN_ID_GEAR_LEVER_POSITION, can_frames[idx], 4);
+}
+
+static void setup_json(void) {
+    serial_set_writer(NULL);
+    serial_set_format(SERIAL_FORMAT_JSON);
+}
+
+static void setup_binary(void) {
+    serial_set_writer(NULL);
+    serial_set_format(SERIAL_FORMAT_BINARY);
+}
+
+// Serial output into the TX ring, as on the device (the bench drains it when full)
+static uint8_t ring_storage[4096];
+static ring_buffer_t bench_ring;
+
+static void ring_writer(const void *data, size_t len) {
+    if (!ring_buffer_write(&bench_ring, data, len)) {
+        const uint8_t *chunk;
+        size_t n;
+        while ((n = ring_buffer_peek(&bench_ring, &chunk)) > 0) {
+            ring_buffer_consume(&bench_ring, n);
+        }
+        ring_buffer_write(&bench_ring, data, len);
+    }
+}
+
+static void setup_json_ring(void) {
+    ring_buffer_init(&bench_ring, ring_storage, sizeof(ring_storage));
+    serial_set_format(SERIAL_FORMAT_JSON);
+    serial_set_writer(ring_writer);
+}
+
+static void setup_binary_ring(void) {
+    setup_json_ring();
+    serial_set_format(SERIAL_FORMAT_BINARY);
+}
+
+static void run_serial_can_rx(uint32_t i) {
+    uint32_t idx = i & FRAME_POOL_MASK;
+    serial_send_can_rx(can_ids[idx], can_frames[idx], 8, i);
+}
+
+static void run_serial_parse(uint32_t i) {
+    uint8_t backlight = BACKLIGHT_DEFAULT;
+    bmw_gear_t gear = GEAR_P;
+    int button = -1;
+    int action = -1;
+    sink += serial_process_received_data(commands[i % COMMAND_COUNT], &backlight, &gear, &button, &action);
+    sink += backlight + button + action;
+}
+
+// Newline-framed batch of all commands, as the app sends them back to back
+static uint8_t command_stream[256];
+static size_t command_stream_len;
+static serial_parser_t bench_parser;
+
+static void count_command(const serial_command_t *cmd, void *ctx) {
+    (void) ctx;
+    sink += cmd->type;
+}
+
+static void setup_parser(void) {
+    setup_json();
+    serial_parser_init(&bench_parser, count_command, NULL);
+    command_stream_len = 0;
+    for (size_t i = 0; i < COMMAND_COUNT; i++) {
+        size_t len = strlen(commands[i]);
+        memcpy(command_stream + command_stream_len, commands[i], len);
+        command_stream_len += len;
+        command_stream[command_stream_len++] = '\n';
+    }
+}
+
+static void run_parser_feed(uint32_t i) {
+    (void) i;
+    sink += serial_parser_feed(&bench_parser, command_stream, command_stream_len);
+}
+
+// Hot-path log line: deferred record vs. formatting it in place
+static char log_line[128];
+
+static int64_t bench_clock(void) {
+    return (int64_t)(now_ns() / 1000u);
+}
+
+static void setup_dlog(void) {
+    dlog_init(bench_clock);
+}
+
+static void run_dlog(uint32_t i) {
+    uint32_t idx = i & FRAME_POOL_MASK;
+    dlog_record_t record;
+    DLOG(GEAR_LEVER, lever_frames[idx], park_frames[idx] == PARK_BUTTON_PRESSED, idx & 7u);
+    sink += dlog_read(&record);  // Keep the ring from filling up
+}
+
+static void run_log_snprintf(uint32_t i) {
+    uint32_t idx = i & FRAME_POOL_MASK;
+    sink += (uint32_t)snprintf(log_line, sizeof(log_line), "Gear lever: pos=0x%02X park=%s gear=%d",
+                               lever_frames[idx], park_frames[idx] == PARK_BUTTON_PRESSED ? "pressed" : "normal", (int)(idx & 7u));
+}
+
+static const bench_case_t bench_cases[] = {
+    {"bmw_process_lever_position",   setup_lever, run_lever},
+    {"bmw_state_snapshot_publish",   setup_snapshot, run_snapshot_publish},
+    {"bmw_state_snapshot_read",      setup_snapshot, run_snapshot_read},
+    {"bmw_update_pkt(0x3FD)",        NULL,        run_update_pkt},
+    {"bmw_tx_cache_next(0x3FD)",     setup_tx_cache, run_tx_cache},
+    {"bmw_verify_pkt(0x197)",        NULL,        run_verify_pkt},
+    {"serial_send_can_rx(json)",     setup_json,  run_serial_can_rx},
+    {"serial_send_can_rx(binary)",   setup_binary, run_serial_can_rx},
+    {"serial_send_can_rx(json,ring)", setup_json_ring, run_serial_can_rx},
+    {"serial_send_can_rx(bin,ring)", setup_binary_ring, run_serial_can_rx},
+    {"serial_process_received_data", setup_json,  run_serial_parse},
+    {"serial_parser_feed(4 cmds)",   setup_parser, run_parser_feed},
+    {"dlog(gear lever)+read",        setup_dlog,  run_dlog},
+    {"snprintf(gear lever)",         NULL,        run_log_snprintf},
+};
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *sorted, uint32_t count, double p) {
+    uint32_t idx = (uint32_t)(p * (double)(count - 1));
+    return sorted[idx];
+}
+
+// Cost of an empty timed region, subtracted from every latency sample
+static uint32_t measure_timer_overhead(void) {
+    enum { SAMPLES = 100000 };
+    static uint32_t samples[SAMPLES];
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+        uint64_t t0 = now_ns();
+        uint64_t t1 = now_ns();
+        samples[i] = (uint32_t)(t1 - t0);
+    }
+    qsort(samples, SAMPLES, sizeof(samples[0]), compare_u32);
+    return samples[SAMPLES / 2];
+}
+
+static void run_case(FILE *report, const bench_case_t *bc, uint32_t ops, uint32_t *samples, uint32_t overhead) {
+    // Throughput pass
+    if (bc->setup) {
+        bc->setup();
+    }
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < ops; i++) {
+        bc->run(i);
+    }
+    uint64_t elapsed = now_ns() - start;
+    fflush(stdout);
+
+    // Latency pass
+    if (bc->setup) {
+        bc->setup();
+    }
+    for (uint32_t i = 0; i < ops; i++) {
+        uint64_t t0 = now_ns();
+        bc->run(i);
+        uint64_t dt = now_ns() - t0;
+        samples[i] = dt > overhead ? (uint32_t)(dt - overhead) : 0;
+    }
+    fflush(stdout);
+    qsort(samples, ops, sizeof(samples[0]), compare_u32);
+
+    fprintf(report, "%-30s %10u %9.1f %8u %8u %8u %8u\n",
+            bc->name, ops, (double)elapsed / (double)ops,
+            percentile(samples, ops, 0.50),
+            percentile(samples, ops, 0.99),
+            percentile(samples, ops, 0.999),
+            samples[ops - 1]);
+    fflush(report);
+}
+
+int main(int argc, char **argv) {
+    uint32_t ops = DEFAULT_OPS;
+    if (argc > 1) {
+        ops = (uint32_t)strtoul(argv[1], NULL, 0);
+        if (ops == 0) {
+            fprintf(stderr, "usage: %s [ops_per_benchmark]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Keep the real stdout for the report, discard protocol output
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    if (report == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        perror("stdout redirect");
+        return 1;
+    }
+    static char stdout_buf[1 << 16];
+    setvbuf(stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
+
+    uint32_t *samples = malloc(sizeof(uint32_t) * ops);
+    if (samples == NULL) {
+        fprintf(stderr, "out of memory for %u samples\n", ops);
+        return 1;
+    }
+
+    generate_frames();
+    uint32_t overhead = measure_timer_overhead();
+
+    fprintf(report, "timer overhead: %u ns (subtracted from latency samples)\n", overhead);
+    fprintf(report, "%-30s %10s %9s %8s %8s %8s %8s\n",
+            "benchmark", "ops", "ns/op", "p50", "p99", "p999", "max");
+    for (size_t i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); i++) {
+        run_case(report, &bench_cases[i], ops, samples, overhead);
+    }
+
+    free(samples);
+    fclose(report);
+    return (int)(sink & 0);
+}
@@ -0,0 +1,168 @@
+// Exhaustive check of the gear transition table against the original if/else code
+// Usage: shifter_table_test
+//
+// The reference below is bmw_process_lever_position(), bmw_lever_up() and
+// bmw_lever_down() as they were before the table (gear-lever.lua port), extended
+// only by the manual shift they imply, which the table version returns. Every
+// gear x previous lever byte x new lever byte x park byte is run from manual gear
+// 0, 1, 254 and 255 (the decrement floor and the wrap-around), and the whole
+// resulting state and the returned shift must match.
+
+#include <stdio.h>
+#include <string.h>
+#include "bmw_shifter.h"
+
+static const uint8_t manual_gears[] = {0, 1, 254, 255};
+
+// --- Reference: if/else state machine from before the transition table ---
+
+static void ref_lever_up(bmw_shifter_state_t *state) {
+    if (state->current_gear == GEAR_P) {
+        state->current_gear = GEAR_N;  // P -> N
+    } else if (state->current_gear == GEAR_D) {
+        state->current_gear = GEAR_N;  // D -> N
+    } else if (state->current_gear == GEAR_N) {
+        state->current_gear = GEAR_R;  // N -> R
+    }
+}
+
+static void ref_lever_down(bmw_shifter_state_t *state) {
+    if (state->current_gear == GEAR_P) {
+        state->current_gear = GEAR_D;  // P -> D
+    } else if (state->current_gear == GEAR_N) {
+        state->current_gear = GEAR_D;  // N -> D
+    } else if (state->current_gear == GEAR_R) {
+        state->current_gear = GEAR_N;  // R -> N
+    }
+}
+
+static bmw_manual_shift_t ref_process_lever_position(bmw_shifter_state_t *state, uint8_t lever_pos,
+                                                     uint8_t park_button) {
+    bmw_manual_shift_t shift = BMW_MANUAL_NONE;
+
+    // Check park button first
+    if (park_button == PARK_BUTTON_PRESSED) {
+        state->current_gear = GEAR_P;
+        state->lever_position = lever_pos;
+        state->park_button = park_button;
+        state->prev_lever_position = lever_pos;
+        return shift;
+    }
+
+    uint8_t prev = state->prev_lever_position;
+
+    // Handle lever up movements
+    if (lever_pos == LEVER_POS_UP_1 && prev == LEVER_POS_CENTER_MIDDLE) {
+        ref_lever_up(state);
+    } else if (lever_pos == LEVER_POS_UP_2 && prev == LEVER_POS_UP_1) {
+        ref_lever_up(state);
+    }
+    // Handle lever down movements
+    else if (lever_pos == LEVER_POS_DOWN_1 && prev == LEVER_POS_CENTER_MIDDLE) {
+        ref_lever_down(state);
+    } else if (lever_pos == LEVER_POS_DOWN_2 && prev == LEVER_POS_DOWN_1) {
+        ref_lever_down(state);
+    }
+    // Handle side movement (manual mode)
+    else if (lever_pos == LEVER_POS_CENTER_SIDE && prev == LEVER_POS_CENTER_MIDDLE && state->current_gear == GEAR_D) {
+        state->current_gear = GEAR_M;
+    } else if (lever_pos == LEVER_POS_CENTER_MIDDLE && prev == LEVER_POS_CENTER_SIDE && state->current_gear == GEAR_M) {
+        state->current_gear = GEAR_D;
+    }
+    // Handle manual gear changes (the shift is reported even when manual_gear stays at 0)
+    else if (prev == LEVER_POS_CENTER_SIDE && state->current_gear == GEAR_M) {
+        if (lever_pos == LEVER_POS_SIDE_UP) {
+            shift = BMW_MANUAL_DEC;
+            if (state->manual_gear > 0) {
+                state->manual_gear--;
+            }
+        } else if (lever_pos == LEVER_POS_SIDE_DOWN) {
+            shift = BMW_MANUAL_INC;
+            state->manual_gear++;
+        }
+    }
+
+    state->lever_position = lever_pos;
+    state->park_button = park_button;
+
+    // Only update prev_lever_position if lever actually moved
+    if (lever_pos != prev) {
+        state->prev_lever_position = lever_pos;
+    }
+    return shift;
+}
+
+// --- Comparison ---
+
+static unsigned long failures = 0;
+
+static bool same_state(const bmw_shifter_state_t *a, const bmw_shifter_state_t *b) {
+    return a->current_gear == b->current_gear && a->manual_gear == b->manual_gear &&
+           a->lever_position == b->lever_position && a->prev_lever_position == b->prev_lever_position &&
+           a->park_button == b->park_button;
+}
+
+static void report(const char *what, const bmw_shifter_state_t *start, unsigned lever_pos, unsigned park,
+                   const bmw_shifter_state_t *ref, const bmw_shifter_state_t *dut,
+                   bmw_manual_shift_t ref_shift, bmw_manual_shift_t dut_shift) {
+    if (++failures > 10) {
+        return;
+    }
+    fprintf(stderr, "%s: gear %d manual %u prev 0x%02X, lever 0x%02X park 0x%02X -> "
+                    "expected gear %d manual %u lever 0x%02X prev 0x%02X shift %d, "
+                    "got gear %d manual %u lever 0x%02X prev 0x%02X shift %d\n",
+            what, start->current_gear, start->manual_gear, start->prev_lever_position, lever_pos, park,
+            ref->current_gear, ref->manual_gear, ref->lever_position, ref->prev_lever_position, ref_shift,
+            dut->current_gear, dut->manual_gear, dut->lever_position, dut->prev_lever_position, dut_shift);
+}
+
+int main(void) {
+    unsigned long cases = 0;
+
+    for (int gear = 0; gear < BMW_GEAR_COUNT; gear++) {
+        for (size_t m = 0; m < sizeof(manual_gears); m++) {
+            bmw_shifter_state_t start;
+            bmw_shifter_init(&start);
+            start.current_gear = (bmw_gear_t)gear;
+            start.manual_gear = manual_gears[m];
+
+            bmw_shifter_state_t ref = start;
+            bmw_shifter_state_t dut = start;
+            ref_lever_up(&ref);
+            bmw_lever_up(&dut);
+            if (!same_state(&ref, &dut)) {
+                report("bmw_lever_up", &start, start.lever_position, start.park_button, &ref, &dut, 0, 0);
+            }
+            ref = start;
+            dut = start;
+            ref_lever_down(&ref);
+            bmw_lever_down(&dut);
+            if (!same_state(&ref, &dut)) {
+                report("bmw_lever_down", &start, start.lever_position, start.park_button, &ref, &dut, 0, 0);
+            }
+
+            for (unsigned prev = 0; prev < 256; prev++) {
+                start.prev_lever_position = (uint8_t)prev;
+                start.lever_position = (uint8_t)prev;
+                for (unsigned lever_pos = 0; lever_pos < 256; lever_pos++) {
+                    for (unsigned park = 0; park < 256; park++) {
+                        ref = start;
+                        dut = start;
+                        bmw_manual_shift_t ref_shift = ref_process_lever_position(&ref, (uint8_t)lever_pos,
+                                                                                  (uint8_t)park);
+                        bmw_manual_shift_t dut_shift = bmw_process_lever_position(&dut, (uint8_t)lever_pos,
+                                                                                  (uint8_t)park);
+                        if (ref_shift != dut_shift || !same_state(&ref, &dut)) {
+                            report("bmw_process_lever_position", &start, lever_pos, park,
+                                   &ref, &dut, ref_shift, dut_shift);
+                        }
+                        cases++;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("%lu transitions checked, %lu mismatches\n", cases, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,6 @@
+#ifndef SIM_IDF_HID_DEVICE_H
+#define SIM_IDF_HID_DEVICE_H
+
+#include "tusb.h"
+
+#endif // SIM_IDF_HID_DEVICE_H
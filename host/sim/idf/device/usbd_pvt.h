@@ -0,0 +1,19 @@
+#ifndef SIM_IDF_USBD_PVT_H
+#define SIM_IDF_USBD_PVT_H
+
+#include "tusb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*osal_task_func_t)(void *param);
+
+// Run func in the TinyUSB task
+void usbd_defer_func(osal_task_func_t func, void *param, bool in_isr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_IDF_USBD_PVT_H
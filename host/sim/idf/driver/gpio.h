@@ -0,0 +1,9 @@
+#ifndef SIM_IDF_GPIO_H
+#define SIM_IDF_GPIO_H
+
+typedef enum {
+    GPIO_NUM_4 = 4,
+    GPIO_NUM_5 = 5,
+} gpio_num_t;
+
+#endif // SIM_IDF_GPIO_H
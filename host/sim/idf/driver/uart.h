@@ -0,0 +1,44 @@
+#ifndef SIM_IDF_UART_H
+#define SIM_IDF_UART_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// UART0 of the simulator: output goes through stdout (serial_tx_task), commands
+// come from the scenario script (sim_shifter.c)
+typedef enum {
+    UART_NUM_0 = 0,
+} uart_port_t;
+
+typedef struct {
+    int baud_rate;
+    int data_bits;
+    int parity;
+    int stop_bits;
+    int flow_ctrl;
+    int source_clk;
+} uart_config_t;
+
+#define UART_DATA_8_BITS               3
+#define UART_PARITY_DISABLE            0
+#define UART_STOP_BITS_1               1
+#define UART_HW_FLOWCTRL_DISABLE       0
+#define UART_SCLK_DEFAULT              0
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size, int tx_buffer_size,
+                              int queue_size, void *uart_queue, int intr_alloc_flags);
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config);
+int uart_read_bytes(uart_port_t port, void *buf, uint32_t length, TickType_t ticks_to_wait);
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_IDF_UART_H
@@ -0,0 +1,35 @@
+#ifndef SIM_IDF_FREERTOS_H
+#define SIM_IDF_FREERTOS_H
+
+// ESP-IDF flavour of FreeRTOS on top of the kernel's POSIX port
+// The firmware includes "freertos/FreeRTOS.h" and uses a few IDF extensions
+// (pinned task creation, spinlock-style critical sections); the simulator has a
+// single core, so they map onto the plain kernel API.
+#include <FreeRTOS.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#undef portNUM_PROCESSORS
+#define portNUM_PROCESSORS             1
+#define tskNO_AFFINITY                 0x7FFFFFFF
+
+typedef struct {
+    uint32_t owner;                    // Unused, critical sections are global on one core
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED   {0}
+
+#undef portENTER_CRITICAL
+#undef portEXIT_CRITICAL
+#define portENTER_CRITICAL(mux)        do { (void)(mux); vPortEnterCritical(); } while (0)
+#define portEXIT_CRITICAL(mux)         do { (void)(mux); vPortExitCritical(); } while (0)
+#define portENTER_CRITICAL_ISR(mux)    portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux)     portEXIT_CRITICAL(mux)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_IDF_FREERTOS_H
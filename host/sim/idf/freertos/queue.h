@@ -0,0 +1,7 @@
+#ifndef SIM_IDF_QUEUE_H
+#define SIM_IDF_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+#include <queue.h>
+
+#endif // SIM_IDF_QUEUE_H
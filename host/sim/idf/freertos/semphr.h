@@ -0,0 +1,7 @@
+#ifndef SIM_IDF_SEMPHR_H
+#define SIM_IDF_SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+#include <semphr.h>
+
+#endif // SIM_IDF_SEMPHR_H
@@ -0,0 +1,27 @@
+#ifndef SIM_IDF_TASK_H
+#define SIM_IDF_TASK_H
+
+#include "freertos/FreeRTOS.h"
+#include <task.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// IDF stack sizes are in bytes, the core is ignored on the single simulated core
+static inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_bytes,
+                                                 void *param, UBaseType_t priority, TaskHandle_t *handle,
+                                                 BaseType_t core) {
+    (void) core;
+    configSTACK_DEPTH_TYPE depth = (configSTACK_DEPTH_TYPE)(stack_bytes / sizeof(StackType_t));
+    if (depth < configMINIMAL_STACK_SIZE) {
+        depth = configMINIMAL_STACK_SIZE;
+    }
+    return xTaskCreate(fn, name, depth, param, priority, handle);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_IDF_TASK_H
@@ -0,0 +1,7 @@
+#ifndef SIM_IDF_TIMERS_H
+#define SIM_IDF_TIMERS_H
+
+#include "freertos/FreeRTOS.h"
+#include <timers.h>
+
+#endif // SIM_IDF_TIMERS_H
@@ -0,0 +1,51 @@
+#ifndef SIM_IDF_TINYUSB_H
+#define SIM_IDF_TINYUSB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "tusb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// esp_tinyusb driver install, the subset usb_hid.c configures
+typedef enum {
+    TINYUSB_EVENT_ATTACHED,
+    TINYUSB_EVENT_DETACHED
+} tinyusb_event_id_t;
+
+typedef struct {
+    tinyusb_event_id_t id;
+    uint8_t rhport;
+} tinyusb_event_t;
+
+typedef void (*tinyusb_event_cb_t)(tinyusb_event_t *event, void *arg);
+
+typedef struct {
+    uint8_t port;
+    struct {
+        size_t size;
+        uint8_t priority;
+        int xCoreID;
+    } task;
+    struct {
+        const void *device;
+        const uint8_t *full_speed_config;
+        const uint8_t *high_speed_config;
+        const char **string;
+        int string_count;
+    } descriptor;
+    tinyusb_event_cb_t event_cb;
+    void *event_arg;
+} tinyusb_config_t;
+
+esp_err_t tinyusb_driver_install(const tinyusb_config_t *config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_IDF_TINYUSB_H
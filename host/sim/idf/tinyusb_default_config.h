@@ -0,0 +1,11 @@
+#ifndef SIM_IDF_TINYUSB_DEFAULT_CONFIG_H
+#define SIM_IDF_TINYUSB_DEFAULT_CONFIG_H
+
+#include "tinyusb.h"
+
+#define TINYUSB_DEFAULT_CONFIG() { \
+        .port = 0, \
+        .task = {.size = 4096, .priority = 5, .xCoreID = 0}, \
+    }
+
+#endif // SIM_IDF_TINYUSB_DEFAULT_CONFIG_H
@@ -0,0 +1,78 @@
+#ifndef SIM_IDF_TUSB_H
+#define SIM_IDF_TUSB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// TinyUSB device API as used by usb_hid.c, served by the simulated host in sim_usb.c
+#define CFG_TUD_HID                    1
+#define CFG_TUD_CDC                    0
+#define CFG_TUD_HID_EP_BUFSIZE         64
+#define CFG_TUD_CDC_EP_BUFSIZE         64
+#define TUD_OPT_HIGH_SPEED             0
+
+#define TUSB_DESC_CONFIGURATION        0x02
+#define TUSB_DESC_INTERFACE            0x04
+#define TUSB_DESC_ENDPOINT             0x05
+#define TUSB_CLASS_HID                 0x03
+#define TUSB_XFER_INTERRUPT            0x03
+#define TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP 0x20
+#define HID_DESC_TYPE_HID              0x21
+#define HID_DESC_TYPE_REPORT           0x22
+
+#define TU_U16_LOW(u16)                ((uint8_t)((u16) & 0xFF))
+#define TU_U16_HIGH(u16)               ((uint8_t)(((u16) >> 8) & 0xFF))
+#define U16_TO_U8S_LE(u16)             TU_U16_LOW(u16), TU_U16_HIGH(u16)
+
+#define TUD_CONFIG_DESC_LEN            9
+#define TUD_HID_DESC_LEN               (9 + 9 + 7)
+#define TUD_CDC_DESC_LEN               (8 + 9 + 5 + 5 + 4 + 5 + 7 + 9 + 7 + 7)
+
+#define TUD_CONFIG_DESCRIPTOR(config_num, _itfcount, _stridx, _total_len, _attribute, _power_ma) \
+    9, TUSB_DESC_CONFIGURATION, U16_TO_U8S_LE(_total_len), _itfcount, config_num, _stridx, \
+    0x80 | (_attribute), (_power_ma) / 2
+
+#define TUD_HID_DESCRIPTOR(_itfnum, _stridx, _boot_protocol, _report_desc_len, _epin, _epsize, _ep_interval) \
+    9, TUSB_DESC_INTERFACE, _itfnum, 0, 1, TUSB_CLASS_HID, (uint8_t)((_boot_protocol) ? 1 : 0), _boot_protocol, _stridx, \
+    9, HID_DESC_TYPE_HID, U16_TO_U8S_LE(0x0111), 0, 1, HID_DESC_TYPE_REPORT, U16_TO_U8S_LE(_report_desc_len), \
+    7, TUSB_DESC_ENDPOINT, _epin, TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(_epsize), _ep_interval
+
+// Report descriptor shape only: the simulated host does not parse it
+#define HID_REPORT_ID(x)               0x85, x,
+#define TUD_HID_REPORT_DESC_GAMEPAD(...) \
+    0x05, 0x01, 0x09, 0x05, 0xA1, 0x01, __VA_ARGS__ 0xC0
+
+typedef enum {
+    HID_REPORT_TYPE_INVALID = 0,
+    HID_REPORT_TYPE_INPUT,
+    HID_REPORT_TYPE_OUTPUT,
+    HID_REPORT_TYPE_FEATURE
+} hid_report_type_t;
+
+bool tud_mounted(void);
+bool tud_connect(void);
+bool tud_disconnect(void);
+bool tud_hid_n_ready(uint8_t instance);
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, const void *report, uint16_t len);
+
+// Application callbacks (usb_hid.c)
+uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance);
+uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type,
+                               uint8_t *buffer, uint16_t reqlen);
+void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type,
+                           uint8_t const *buffer, uint16_t bufsize);
+bool tud_hid_set_idle_cb(uint8_t instance, uint8_t idle_rate);
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len);
+void tud_suspend_cb(bool remote_wakeup_en);
+void tud_resume_cb(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_IDF_TUSB_H
@@ -0,0 +1,72 @@
+# Run shifter_sim on a scenario and compare its trace with a golden file
+#   cmake -DSIM=<shifter_sim> -DSCENARIO=<x.txt> -DGOLDEN=<x.golden> -DWORK_DIR=<dir> [-DUPDATE=ON] -P run_scenario.cmake
+#
+# The trace is reduced to what the scenario decides, without the tick times and the
+# rolling counters/CRCs: shifter, UART, USB and SIM lines as they are, HID reports and
+# the 0x3FD indication / 0x202 level only when they change. UPDATE=ON rewrites the
+# golden file from this run.
+
+foreach(var SIM SCENARIO GOLDEN WORK_DIR)
+    if(NOT ${var})
+        message(FATAL_ERROR "run_scenario.cmake: ${var} is not set")
+    endif()
+endforeach()
+
+get_filename_component(name ${SCENARIO} NAME_WE)
+set(trace ${WORK_DIR}/${name}.trace.txt)
+set(events ${WORK_DIR}/${name}.events.txt)
+
+# stdout carries the serial protocol, not needed here
+execute_process(COMMAND ${SIM} ${SCENARIO} ${trace}
+                RESULT_VARIABLE rc OUTPUT_QUIET TIMEOUT 60)
+if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "shifter_sim ${SCENARIO} failed: ${rc}")
+endif()
+
+file(STRINGS ${trace} lines)
+set(out "")
+set(last_hid "")
+set(last_3fd "")
+set(last_202 "")
+foreach(line IN LISTS lines)
+    if(NOT line MATCHES "^ *[0-9]+ (.*)$")
+        continue()
+    endif()
+    set(entry "${CMAKE_MATCH_1}")
+    if(entry MATCHES "^CAN TX +([0-9A-F]+) \\[[0-9]+\\] (.*)$")
+        set(id ${CMAKE_MATCH_1})
+        set(data "${CMAKE_MATCH_2}")
+        if(id STREQUAL "3FD")
+            string(SUBSTRING "${data}" 6 2 value)   # Byte 2: gear indication
+            if(NOT value STREQUAL last_3fd)
+                set(last_3fd ${value})
+                string(APPEND out "CAN TX   3FD indication 0x${value}\n")
+            endif()
+        elseif(id STREQUAL "202")
+            string(SUBSTRING "${data}" 0 2 value)   # Byte 0: backlight level
+            if(NOT value STREQUAL last_202)
+                set(last_202 ${value})
+                string(APPEND out "CAN TX   202 level 0x${value}\n")
+            endif()
+        endif()
+    elseif(entry MATCHES "^HID ")
+        if(NOT entry STREQUAL last_hid)
+            set(last_hid "${entry}")
+            string(APPEND out "${entry}\n")
+        endif()
+    else()
+        string(APPEND out "${entry}\n")
+    endif()
+endforeach()
+file(WRITE ${events} "${out}")
+
+if(UPDATE)
+    file(WRITE ${GOLDEN} "${out}")
+    message(STATUS "Updated ${GOLDEN}")
+    return()
+endif()
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${events} ${GOLDEN} RESULT_VARIABLE differs)
+if(differs)
+    file(READ ${GOLDEN} expected)
+    message(FATAL_ERROR "${name}: trace differs from ${GOLDEN}\n--- expected\n${expected}--- got (${events})\n${out}")
+endif()
@@ -0,0 +1,32 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Linux simulator of the whole firmware (FreeRTOS POSIX port)
+// app_main and every firmware task run unmodified; the IDF pieces they touch are
+// replaced by sim_idf.c (esp_timer, log, UART0), sim_usb.c (TinyUSB device and a
+// polling host) and sim_shifter.c (TWAI backend and a scripted virtual shifter).
+
+// Timeline: one line per event, "<ms> <kind> <details>", time in scheduler ticks
+void sim_trace_open(const char *path);
+void sim_trace(const char *kind, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void sim_exit(int code);
+
+// Virtual shifter scenario
+bool sim_shifter_load(const char *path);
+
+// Bytes for serial_rx_task, as if the app had sent them over UART0
+void sim_uart_inject(const char *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_H
@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include <stream_buffer.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/uart.h"
+#include "sim.h"
+
+// esp_err
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK:                return "ESP_OK";
+        case ESP_FAIL:              return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:        return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:   return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:  return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:     return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:       return "ESP_ERR_TIMEOUT";
+        default:                    return "ERROR";
+    }
+}
+
+// esp_log
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    va_list args;
+    (void) level;
+    (void) tag;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+uint32_t esp_log_timestamp(void) {
+    return (uint32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS);
+}
+
+// esp_timer
+// One-shot FreeRTOS timers rounded up to whole ticks; active is tracked here because
+// the timer daemon applies start/stop commands asynchronously.
+
+struct esp_timer {
+    TimerHandle_t timer;
+    esp_timer_cb_t callback;
+    void *arg;
+    volatile bool active;
+};
+
+static int64_t start_time_us = 0;
+
+int64_t esp_timer_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t now = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (start_time_us == 0) {
+        start_time_us = now;
+    }
+    return now - start_time_us;
+}
+
+static void timer_expired(TimerHandle_t timer) {
+    struct esp_timer *t = pvTimerGetTimerID(timer);
+    t->active = false;
+    t->callback(t->arg);
+}
+
+// Never block the daemon on its own command queue
+static TickType_t timer_block_time(void) {
+    return xTaskGetCurrentTaskHandle() == xTimerGetTimerDaemonTaskHandle() ? 0 : portMAX_DELAY;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out_handle) {
+    if (args == NULL || args->callback == NULL || out_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct esp_timer *t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    t->callback = args->callback;
+    t->arg = args->arg;
+    t->timer = xTimerCreate(args->name ? args->name : "esp_timer", 1, pdFALSE, t, timer_expired);
+    if (t->timer == NULL) {
+        free(t);
+        return ESP_ERR_NO_MEM;
+    }
+    *out_handle = t;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    if (timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint64_t ticks = (timeout_us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000);
+    timer->active = true;
+    if (xTimerChangePeriod(timer->timer, ticks ? (TickType_t)ticks : 1, timer_block_time()) != pdPASS) {
+        timer->active = false;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (!timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = false;
+    xTimerStop(timer->timer, timer_block_time());
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    return timer->active;
+}
+
+// UART0: RX is fed by the scenario, TX goes through stdout (serial_tx_task)
+
+static StreamBufferHandle_t uart_rx = NULL;
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size, int tx_buffer_size,
+                              int queue_size, void *uart_queue, int intr_alloc_flags) {
+    (void) port;
+    (void) tx_buffer_size;
+    (void) queue_size;
+    (void) uart_queue;
+    (void) intr_alloc_flags;
+    uart_rx = xStreamBufferCreate((size_t)rx_buffer_size, 1);
+    return uart_rx != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config) {
+    (void) port;
+    (void) config;
+    return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t port, void *buf, uint32_t length, TickType_t ticks_to_wait) {
+    (void) port;
+    if (uart_rx == NULL) {
+        vTaskDelay(ticks_to_wait);
+        return 0;
+    }
+    return (int)xStreamBufferReceive(uart_rx, buf, length, ticks_to_wait);
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t *size) {
+    (void) port;
+    *size = uart_rx != NULL ? xStreamBufferBytesAvailable(uart_rx) : 0;
+    return ESP_OK;
+}
+
+void sim_uart_inject(const char *data, size_t len) {
+    if (uart_rx == NULL || xStreamBufferSend(uart_rx, data, len, 0) != len) {
+        sim_trace("UART", "rx overflow, %u bytes lost", (unsigned)len);
+    }
+}
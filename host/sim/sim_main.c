@@ -0,0 +1,81 @@
+// Linux simulator of the shifter firmware
+// Usage: shifter_sim <scenario> [trace_file]
+//
+// Runs app_main and all firmware tasks on the FreeRTOS POSIX port against a
+// scripted virtual shifter (see scenarios/). The timeline of CAN TX frames, HID
+// reports seen by the simulated host and scenario events goes to trace_file
+// (default stdout is taken by the serial protocol, so the default is sim_trace.txt).
+// Firmware logs go to stderr.
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "app_clock.h"
+#include "sim.h"
+
+#define SIM_MAIN_TASK_PRIORITY  1      // ESP-IDF main task priority
+#define SIM_MAIN_TASK_STACK     8192
+
+void app_main(void);
+
+static FILE *trace_file = NULL;
+
+void sim_trace_open(const char *path) {
+    trace_file = fopen(path, "w");
+    if (trace_file == NULL) {
+        perror(path);
+        exit(1);
+    }
+}
+
+void sim_trace(const char *kind, const char *format, ...) {
+    va_list args;
+
+    vTaskSuspendAll();  // Keep lines whole and in order
+    fprintf(trace_file, "%8lu %-8s ", (unsigned long)(xTaskGetTickCount() * portTICK_PERIOD_MS), kind);
+    va_start(args, format);
+    vfprintf(trace_file, format, args);
+    va_end(args);
+    fputc('\n', trace_file);
+    xTaskResumeAll();
+}
+
+void sim_exit(int code) {
+    fflush(stdout);
+    if (trace_file != NULL) {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    exit(code);
+}
+
+// Application time in whole scheduler ticks: pulses, throttles and the loss timeout
+// are decided on the same tick grid as the trace, so reruns do not drift with host load
+static int64_t sim_clock_us(void) {
+    return (int64_t)xTaskGetTickCount() * portTICK_PERIOD_MS * 1000;
+}
+
+// The IDF main task: app_main never returns in this firmware
+static void main_task(void *arg) {
+    (void) arg;
+    app_main();
+    vTaskDelete(NULL);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <scenario> [trace_file]\n", argv[0]);
+        return 1;
+    }
+    if (!sim_shifter_load(argv[1])) {
+        return 1;
+    }
+    sim_trace_open(argc > 2 ? argv[2] : "sim_trace.txt");
+    app_clock_set_source(sim_clock_us);
+
+    xTaskCreate(main_task, "main", SIM_MAIN_TASK_STACK, NULL, SIM_MAIN_TASK_PRIORITY, NULL);
+    vTaskStartScheduler();
+    return 0;
+}
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "can_hal.h"
+#include "bmw_shifter.h"
+#include "sim.h"
+
+// Virtual shifter on a simulated TWAI controller
+// The shifter sends 0x197 every TIMING_GEAR_LEVER_RX_MS (CRC and counter like the
+// real one) and a 0x55E heartbeat, following a scenario script:
+//
+//   # comment
+//   <ms> lever center|up1|up2|down1|down2|side|side_up|side_down
+//   <ms> park press|release
+//   <ms> bus off|on          shifter falls silent / comes back
+//   <ms> cmd <json>          line sent by the app over UART0
+//   <ms> end                 stop the simulation
+//
+// Times are absolute milliseconds since start and must not decrease.
+
+static const char *TAG = "SIM_SHIFTER";
+
+#define SIM_RX_QUEUE_LEN         32      // Same as the TWAI driver
+#define SIM_SHIFTER_PRIORITY     (configMAX_PRIORITIES - 1)  // The bus is not a task of the firmware
+#define SIM_SHIFTER_STACK        8192
+#define SIM_HEARTBEAT_MS         640
+#define SIM_MAX_EVENTS           1024
+#define SIM_MAX_CMD_LEN          128
+
+typedef enum {
+    SIM_EVENT_LEVER,
+    SIM_EVENT_PARK,
+    SIM_EVENT_BUS,
+    SIM_EVENT_CMD,
+    SIM_EVENT_END
+} sim_event_type_t;
+
+typedef struct {
+    uint32_t time_ms;
+    sim_event_type_t type;
+    uint8_t value;                  // Lever code, park code or bus on/off
+    char cmd[SIM_MAX_CMD_LEN];
+} sim_event_t;
+
+static const struct {
+    const char *name;
+    uint8_t code;
+} lever_names[] = {
+    {"center", LEVER_POS_CENTER_MIDDLE}, {"up1", LEVER_POS_UP_1}, {"up2", LEVER_POS_UP_2},
+    {"down1", LEVER_POS_DOWN_1}, {"down2", LEVER_POS_DOWN_2}, {"side", LEVER_POS_CENTER_SIDE},
+    {"side_up", LEVER_POS_SIDE_UP}, {"side_down", LEVER_POS_SIDE_DOWN},
+};
+
+static sim_event_t *events = NULL;
+static size_t event_count = 0;
+
+static QueueHandle_t rx_queue = NULL;
+static SemaphoreHandle_t tx_done_sem = NULL;
+static volatile uint32_t tx_done = 0;       // Transmitted, not yet reported by tx_wait
+static portMUX_TYPE tx_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t rx_overruns = 0;
+
+static bool parse_event(char *line, sim_event_t *ev) {
+    char word[16];
+    char arg[16];
+    int used = 0;
+    unsigned long time_ms;
+
+    if (sscanf(line, "%lu %15s %n", &time_ms, word, &used) < 2) {
+        return false;
+    }
+    memset(ev, 0, sizeof(*ev));
+    ev->time_ms = (uint32_t)time_ms;
+    char *rest = line + used;
+
+    if (strcmp(word, "end") == 0) {
+        ev->type = SIM_EVENT_END;
+        return true;
+    }
+    if (strcmp(word, "cmd") == 0) {
+        size_t len = strcspn(rest, "\r\n");
+        if (len == 0 || len >= sizeof(ev->cmd)) {
+            return false;
+        }
+        ev->type = SIM_EVENT_CMD;
+        memcpy(ev->cmd, rest, len);
+        return true;
+    }
+    if (sscanf(rest, "%15s", arg) != 1) {
+        return false;
+    }
+    if (strcmp(word, "lever") == 0) {
+        for (size_t i = 0; i < sizeof(lever_names) / sizeof(lever_names[0]); i++) {
+            if (strcmp(arg, lever_names[i].name) == 0) {
+                ev->type = SIM_EVENT_LEVER;
+                ev->value = lever_names[i].code;
+                return true;
+            }
+        }
+        return false;
+    }
+    if (strcmp(word, "park") == 0 && (strcmp(arg, "press") == 0 || strcmp(arg, "release") == 0)) {
+        ev->type = SIM_EVENT_PARK;
+        ev->value = arg[0] == 'p' ? PARK_BUTTON_PRESSED : PARK_BUTTON_NORMAL;
+        return true;
+    }
+    if (strcmp(word, "bus") == 0 && (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0)) {
+        ev->type = SIM_EVENT_BUS;
+        ev->value = strcmp(arg, "on") == 0;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Load a scenario script (before the scheduler starts)
+ */
+bool sim_shifter_load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    events = calloc(SIM_MAX_EVENTS, sizeof(sim_event_t));
+    if (events == NULL) {
+        fclose(f);
+        return false;
+    }
+
+    char line[256];
+    unsigned line_no = 0;
+    uint32_t last_ms = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f) != NULL) {
+        line_no++;
+        char *p = line;
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        if (event_count == SIM_MAX_EVENTS || !parse_event(p, &events[event_count]) ||
+            events[event_count].time_ms < last_ms) {
+            fprintf(stderr, "%s:%u: invalid scenario line\n", path, line_no);
+            ok = false;
+            break;
+        }
+        last_ms = events[event_count++].time_ms;
+    }
+    fclose(f);
+    return ok;
+}
+
+// Queue a frame for the firmware, as the TWAI RX queue would
+static void bus_deliver(uint32_t id, const uint8_t *data, uint8_t dlc) {
+    can_frame_t frame = {
+        .id = id,
+        .dlc = dlc,
+    };
+    memcpy(frame.data, data, dlc);
+    if (xQueueSend(rx_queue, &frame, 0) != pdTRUE) {
+        rx_overruns++;
+        sim_trace("CAN", "RX overrun %03lX (%lu)", (unsigned long)id, (unsigned long)rx_overruns);
+    }
+}
+
+static void shifter_task(void *arg) {
+    uint8_t lever = LEVER_POS_CENTER_MIDDLE;
+    uint8_t park = PARK_BUTTON_NORMAL;
+    bool bus_on = true;
+    size_t next_event = 0;
+    TickType_t last_wake = xTaskGetTickCount();
+    TickType_t start = last_wake;
+    (void) arg;
+
+    while (1) {
+        uint32_t now_ms = (uint32_t)((xTaskGetTickCount() - start) * portTICK_PERIOD_MS);
+
+        while (next_event < event_count && events[next_event].time_ms <= now_ms) {
+            const sim_event_t *ev = &events[next_event++];
+            switch (ev->type) {
+                case SIM_EVENT_LEVER:
+                    lever = ev->value;
+                    sim_trace("SHIFTER", "lever 0x%02X", lever);
+                    break;
+                case SIM_EVENT_PARK:
+                    park = ev->value;
+                    sim_trace("SHIFTER", "park 0x%02X", park);
+                    break;
+                case SIM_EVENT_BUS:
+                    bus_on = ev->value != 0;
+                    sim_trace("SHIFTER", "bus %s", bus_on ? "on" : "off");
+                    break;
+                case SIM_EVENT_CMD:
+                    sim_trace("UART", "rx %s", ev->cmd);
+                    sim_uart_inject(ev->cmd, strlen(ev->cmd));
+                    sim_uart_inject("\n", 1);
+                    break;
+                case SIM_EVENT_END:
+                    sim_trace("SIM", "end, %lu RX overruns", (unsigned long)rx_overruns);
+                    sim_exit(0);
+                    break;
+            }
+        }
+
+        if (bus_on && now_ms % TIMING_GEAR_LEVER_RX_MS == 0) {
+            uint8_t data[4] = {0x00, 0x00, lever, park};
+            bmw_update_pkt(CAN_ID_GEAR_LEVER_POSITION, data, sizeof(data));
+            bus_deliver(CAN_ID_GEAR_LEVER_POSITION, data, sizeof(data));
+        }
+        if (bus_on && now_ms % SIM_HEARTBEAT_MS == 0) {
+            static const uint8_t heartbeat[8] = {0, 0, 0, 0, 0x01, 0, 0, 0x5E};
+            bus_deliver(CAN_ID_GEAR_LEVER_HEARTBEAT, heartbeat, sizeof(heartbeat));
+        }
+        vTaskDelayUntil(&last_wake, 1);
+    }
+}
+
+/**
+ * Simulated TWAI driver: starts the virtual shifter on the bus
+ */
+esp_err_t can_hal_twai_start(int tx_gpio, int rx_gpio) {
+    (void) tx_gpio;
+    (void) rx_gpio;
+    rx_queue = xQueueCreate(SIM_RX_QUEUE_LEN, sizeof(can_frame_t));
+    tx_done_sem = xSemaphoreCreateBinary();
+    if (rx_queue == NULL || tx_done_sem == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(shifter_task, "sim_shifter", SIM_SHIFTER_STACK, NULL, SIM_SHIFTER_PRIORITY, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Virtual shifter started, %u scenario events", (unsigned)event_count);
+    return ESP_OK;
+}
+
+static can_hal_status_t sim_receive(can_frame_t *frame, uint32_t timeout_ms) {
+    if (xQueueReceive(rx_queue, frame, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        return CAN_HAL_ERR_TIMEOUT;
+    }
+    frame->timestamp_us = (uint64_t)esp_timer_get_time();
+    return CAN_HAL_OK;
+}
+
+// Every frame is acknowledged at once: the shifter is always listening
+static can_hal_status_t sim_transmit(const can_frame_t *frame, uint32_t timeout_ms) {
+    char hex[3 * 8 + 1] = "";
+    (void) timeout_ms;
+
+    for (uint8_t i = 0; i < frame->dlc && i < 8; i++) {
+        snprintf(&hex[i * 3], 4, "%02X ", frame->data[i]);
+    }
+    sim_trace("CAN TX", "%03lX [%u] %s", (unsigned long)frame->id, frame->dlc, hex);
+
+    portENTER_CRITICAL(&tx_lock);
+    tx_done++;
+    portEXIT_CRITICAL(&tx_lock);
+    xSemaphoreGive(tx_done_sem);
+    return CAN_HAL_OK;
+}
+
+static can_hal_status_t sim_tx_wait(uint32_t timeout_ms, uint32_t *done, uint32_t *failed) {
+    if (tx_done == 0) {
+        xSemaphoreTake(tx_done_sem, pdMS_TO_TICKS(timeout_ms));
+    }
+    portENTER_CRITICAL(&tx_lock);
+    *done = tx_done;
+    tx_done = 0;
+    portEXIT_CRITICAL(&tx_lock);
+    *failed = 0;
+    return *done > 0 ? CAN_HAL_OK : CAN_HAL_ERR_TIMEOUT;
+}
+
+static can_hal_status_t sim_rx_loss(can_hal_rx_loss_t *loss) {
+    loss->queue_full = rx_overruns;
+    loss->fifo_overrun = 0;
+    return CAN_HAL_OK;
+}
+
+const can_hal_backend_t can_hal_twai_backend = {
+    .name = "sim_twai",
+    .receive = sim_receive,
+    .transmit = sim_transmit,
+    .tx_wait = sim_tx_wait,
+    .rx_loss = sim_rx_loss,
+};
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+#include "tinyusb.h"
+#include "device/usbd_pvt.h"
+#include "sim.h"
+
+// Simulated TinyUSB device and USB host
+// The device task runs deferred functions like esp_tinyusb's TinyUSB task. The
+// host enumerates the device SIM_USB_ENUM_MS after install, sends SET_IDLE 0 and
+// reads the interrupt IN endpoint every bInterval ms: a report handed to
+// tud_hid_n_report() is delivered (traced) on the next poll, then completed.
+
+#define SIM_USB_ENUM_MS          50
+#define SIM_USB_QUEUE_LEN        64
+#define SIM_USB_TASK_STACK       8192
+#define SIM_HID_EP_IN            0x81
+
+typedef struct {
+    osal_task_func_t func;
+    void *param;
+} deferred_t;
+
+static tinyusb_config_t config;
+static QueueHandle_t usb_queue = NULL;
+static TimerHandle_t enum_timer = NULL;
+static TimerHandle_t poll_timer = NULL;
+static volatile bool mounted = false;
+static volatile bool in_flight = false;
+static uint8_t ep_buf[1 + CFG_TUD_HID_EP_BUFSIZE];   // Report ID + report
+static uint16_t ep_len = 0;
+static uint8_t poll_interval_ms = 1;
+
+static void usb_task(void *arg) {
+    deferred_t d;
+    (void) arg;
+
+    while (1) {
+        if (xQueueReceive(usb_queue, &d, portMAX_DELAY) == pdTRUE) {
+            d.func(d.param);
+        }
+    }
+}
+
+void usbd_defer_func(osal_task_func_t func, void *param, bool in_isr) {
+    deferred_t d = {func, param};
+    (void) in_isr;
+    if (xQueueSend(usb_queue, &d, 0) != pdTRUE) {
+        sim_trace("USB", "event queue full, deferred call lost");
+    }
+}
+
+// bInterval of the HID IN endpoint from the configuration descriptor
+static uint8_t hid_poll_interval(void) {
+    const uint8_t *desc = config.descriptor.full_speed_config;
+    uint16_t total = (uint16_t)(desc[2] | (desc[3] << 8));
+
+    for (uint16_t i = 0; i + 1 < total && desc[i] != 0; i += desc[i]) {
+        if (desc[i + 1] == TUSB_DESC_ENDPOINT && desc[i + 2] == SIM_HID_EP_IN) {
+            return desc[i + 6] ? desc[i + 6] : 1;
+        }
+    }
+    return 1;
+}
+
+// Host side: enumeration done (TinyUSB task)
+static void host_attach(void *param) {
+    (void) param;
+    poll_interval_ms = hid_poll_interval();
+    mounted = true;
+    sim_trace("USB", "attached, HID poll %u ms", poll_interval_ms);
+    if (config.event_cb != NULL) {
+        tinyusb_event_t event = {.id = TINYUSB_EVENT_ATTACHED, .rhport = 0};
+        config.event_cb(&event, config.event_arg);
+    }
+    tud_hid_set_idle_cb(0, 0);
+}
+
+// Device side: pulled off the bus by tud_disconnect() (TinyUSB task)
+static void host_detach(void *param) {
+    (void) param;
+    sim_trace("USB", "detached");
+    if (config.event_cb != NULL) {
+        tinyusb_event_t event = {.id = TINYUSB_EVENT_DETACHED, .rhport = 0};
+        config.event_cb(&event, config.event_arg);
+    }
+}
+
+// Host side: the IN endpoint was read (TinyUSB task)
+static void host_poll_done(void *param) {
+    (void) param;
+    if (!mounted || !in_flight) {
+        return;
+    }
+    uint32_t buttons = 0;
+    if (ep_len >= 5) {
+        memcpy(&buttons, &ep_buf[ep_len - 4], sizeof(buttons));  // Last field of the gamepad report
+    }
+    sim_trace("HID", "report %u buttons 0x%08lX", ep_buf[0], (unsigned long)buttons);
+    in_flight = false;
+    tud_hid_report_complete_cb(0, ep_buf, ep_len);
+}
+
+static void enum_timer_expired(TimerHandle_t timer) {
+    (void) timer;
+    usbd_defer_func(host_attach, NULL, false);
+}
+
+static void poll_timer_expired(TimerHandle_t timer) {
+    (void) timer;
+    usbd_defer_func(host_poll_done, NULL, false);
+}
+
+esp_err_t tinyusb_driver_install(const tinyusb_config_t *cfg) {
+    if (cfg == NULL || cfg->descriptor.full_speed_config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    config = *cfg;
+    usb_queue = xQueueCreate(SIM_USB_QUEUE_LEN, sizeof(deferred_t));
+    enum_timer = xTimerCreate("usb_enum", pdMS_TO_TICKS(SIM_USB_ENUM_MS), pdFALSE, NULL, enum_timer_expired);
+    poll_timer = xTimerCreate("usb_poll", 1, pdFALSE, NULL, poll_timer_expired);
+    if (usb_queue == NULL || enum_timer == NULL || poll_timer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(usb_task, "TinyUSB", SIM_USB_TASK_STACK, NULL, cfg->task.priority, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    tud_connect();
+    return ESP_OK;
+}
+
+bool tud_mounted(void) {
+    return mounted;
+}
+
+bool tud_connect(void) {
+    return xTimerReset(enum_timer, portMAX_DELAY) == pdPASS;
+}
+
+bool tud_disconnect(void) {
+    mounted = false;
+    in_flight = false;
+    xTimerStop(poll_timer, portMAX_DELAY);
+    usbd_defer_func(host_detach, NULL, false);
+    return true;
+}
+
+bool tud_hid_n_ready(uint8_t instance) {
+    (void) instance;
+    return mounted && !in_flight;
+}
+
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, const void *report, uint16_t len) {
+    (void) instance;
+    if (!tud_hid_n_ready(0) || len > CFG_TUD_HID_EP_BUFSIZE) {
+        return false;
+    }
+    ep_buf[0] = report_id;
+    memcpy(&ep_buf[1], report, len);
+    ep_len = (uint16_t)(len + 1);
+    in_flight = true;
+    xTimerChangePeriod(poll_timer, pdMS_TO_TICKS(poll_interval_ms), 0);
+    return true;
+}
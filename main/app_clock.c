@@ -0,0 +1,58 @@
+#include "app_clock.h"
+#include <stddef.h>
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#endif
+
+static int64_t virtual_now_us = 0;
+
+static int64_t virtual_clock(void) {
+    return virtual_now_us;
+}
+
+#ifdef ESP_PLATFORM
+static app_clock_fn_t clock_source = esp_timer_get_time;
+#else
+static app_clock_fn_t clock_source = virtual_clock;
+#endif
+
+/**
+ * Install a time source in microseconds (NULL switches back to the virtual clock)
+ */
+void app_clock_set_source(app_clock_fn_t now_us) {
+    clock_source = now_us != NULL ? now_us : virtual_clock;
+}
+
+int64_t app_clock_now_us(void) {
+    return clock_source();
+}
+
+/**
+ * Milliseconds, wrapping every ~49 days - compare with app_clock_elapsed_ms()
+ */
+uint32_t app_clock_now_ms(void) {
+    return (uint32_t)(clock_source() / 1000);
+}
+
+/**
+ * True once more than interval_ms has passed since since_ms (wrap-safe)
+ */
+bool app_clock_elapsed_ms(uint32_t since_ms, uint32_t interval_ms) {
+    return app_clock_now_ms() - since_ms > interval_ms;
+}
+
+/**
+ * Switch to the virtual clock and set it to start_us
+ */
+void app_clock_use_virtual(int64_t start_us) {
+    virtual_now_us = start_us;
+    clock_source = virtual_clock;
+}
+
+void app_clock_set_us(int64_t now_us) {
+    virtual_now_us = now_us;
+}
+
+void app_clock_advance_us(int64_t delta_us) {
+    virtual_now_us += delta_us;
+}
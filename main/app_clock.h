@@ -0,0 +1,34 @@
+#ifndef APP_CLOCK_H
+#define APP_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Time source for the application's timing logic (pulses, throttles, shifter loss)
+// On the device it is esp_timer_get_time(). Host builds start on a virtual clock
+// that only moves when the caller sets or advances it, so hours of driving can be
+// replayed in seconds with the same decisions every run. Any other source (e.g. the
+// simulator's tick clock) can be installed with app_clock_set_source().
+// The virtual clock is a plain variable: drive it from one thread.
+typedef int64_t (*app_clock_fn_t)(void);
+
+// Function declarations
+void app_clock_set_source(app_clock_fn_t now_us);
+int64_t app_clock_now_us(void);
+uint32_t app_clock_now_ms(void);
+bool app_clock_elapsed_ms(uint32_t since_ms, uint32_t interval_ms);
+
+// Virtual clock
+void app_clock_use_virtual(int64_t start_us);
+void app_clock_set_us(int64_t now_us);
+void app_clock_advance_us(int64_t delta_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // APP_CLOCK_H
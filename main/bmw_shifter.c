@@ -21,47 +21,70 @@ static const uint8_t crc_table[256] = {
     0x7F, 0x62, 0x45, 0x58, 0x0B, 0x16, 0x31, 0x2C, 0x97, 0x8A, 0xAD, 0xB0, 0xE3, 0xFE, 0xD9, 0xC4
 };
 
-// CRC start values for different CAN IDs (from egs_utils.lua)
-static uint8_t get_crc_start_value(uint16_t can_id) {
-    switch (can_id) {
-        case 0x08F: return 0x75;
-        case 0x0A0: return 0xBC;
-        case 0x0A5: return 0x16;
-        case 0x0A6: return 0xC2;
-        case 0x0A7: return 0x8E;
-        case 0x0B0: return 0x4C;
-        case 0x0C2: return 0xD8;
-        case 0x0D9: return 0x3E;
-        case 0x0EF: return 0x98;
-        case 0x12F: return 0x60;
-        case 0x145: return 0x48;
-        case 0x163: return 0xA0;
-        case 0x173: return 0x13;
-        case 0x197: return 0x62;  // Gear lever position
-        case 0x199: return 0x8F;
-        case 0x19A: return 0x17;
-        case 0x19F: return 0xEF;
-        case 0x1A1: return 0x77;
-        case 0x1AF: return 0xB5;
-        case 0x1E1: return 0x78;
-        case 0x1FC: return 0x66;
-        case 0x207: return 0x51;
-        case 0x254: return 0xB8;
-        case 0x297: return 0xDF;
-        case 0x2C5: return 0xFC;
-        case 0x2E0: return 0x5B;
-        case 0x2ED: return 0x1D;
-        case 0x302: return 0xC3;
-        case 0x30B: return 0xBE;
-        case 0x3A7: return 0x05;
-        case 0x3F9: return 0x38;
-        case 0x3FD: return 0xD7;  // Display gear indication
-        default: return 0x00;
+// CRC/counter registry (CRC start values from egs_utils.lua)
+// Sorted by CAN ID for binary search. A start value of 0x00 marks an ID that
+// only carries a rolling counter (0x202 backlight).
+typedef struct {
+    uint16_t can_id;
+    uint8_t crc_start;
+} bmw_crc_entry_t;
+
+static const bmw_crc_entry_t crc_registry[] = {
+    {0x08F, 0x75}, {0x0A0, 0xBC}, {0x0A5, 0x16}, {0x0A6, 0xC2},
+    {0x0A7, 0x8E}, {0x0B0, 0x4C}, {0x0C2, 0xD8}, {0x0D9, 0x3E},
+    {0x0EF, 0x98}, {0x12F, 0x60}, {0x145, 0x48}, {0x163, 0xA0},
+    {0x173, 0x13},
+    {0x197, 0x62},  // Gear lever position
+    {0x199, 0x8F}, {0x19A, 0x17}, {0x19F, 0xEF}, {0x1A1, 0x77},
+    {0x1AF, 0xB5}, {0x1E1, 0x78}, {0x1FC, 0x66},
+    {0x202, 0x00},  // Backlight - counter only, no CRC
+    {0x207, 0x51}, {0x254, 0xB8}, {0x297, 0xDF}, {0x2C5, 0xFC},
+    {0x2E0, 0x5B}, {0x2ED, 0x1D}, {0x302, 0xC3}, {0x30B, 0xBE},
+    {0x3A7, 0x05}, {0x3F9, 0x38},
+    {0x3FD, 0xD7},  // Display gear indication
+};
+
+#define CRC_REGISTRY_SIZE  (sizeof(crc_registry) / sizeof(crc_registry[0]))
+#define RX_COUNTER_NONE    0xFF  // No frame seen yet
+
+// Rolling counters, indexed like crc_registry
+static uint8_t tx_counters[CRC_REGISTRY_SIZE];                    // Next counter to send (0-14, cyclic)
+static uint8_t rx_counters[CRC_REGISTRY_SIZE] = {                // Last counter received
+    [0 ... CRC_REGISTRY_SIZE - 1] = RX_COUNTER_NONE
+};
+
+// Registry slot of a CAN ID, -1 if the ID is not known
+static int crc_registry_find(uint16_t can_id) {
+    int lo = 0;
+    int hi = (int)CRC_REGISTRY_SIZE - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (crc_registry[mid].can_id == can_id) {
+            return mid;
+        }
+        if (crc_registry[mid].can_id < can_id) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
     }
+    return -1;
 }
 
-// Packet counters for each CAN ID (0-14, cyclic)
-static uint8_t pkt_counters[0x400] = {0};  // Support up to 0x3FF CAN IDs
+static uint8_t crc_compute(uint8_t crc_start, const uint8_t *data, uint8_t data_len) {
+    uint8_t crc = crc_start;
+    // Process bytes from index 1 to data_len-1 (CRC is in byte 0)
+    for (int i = 1; i < data_len; i++) {
+        crc = crc_table[crc ^ data[i]];
+    }
+    return crc;
+}
+
+static uint8_t tx_counter_next(int slot) {
+    uint8_t counter = tx_counters[slot];
+    tx_counters[slot] = counter + 1 == BMW_COUNTER_MODULO ? 0 : counter + 1;
+    return counter;
+}
 
 /**
  * Update packet CRC and counter
@@ -72,28 +95,96 @@ static uint8_t pkt_counters[0x400] = {0};  // Support up to 0x3FF CAN IDs
  * @param data_len Total length of data array
  */
 void bmw_update_pkt(uint16_t can_id, uint8_t *data, uint8_t data_len) {
-    uint8_t crc_start = get_crc_start_value(can_id);
-    if (crc_start == 0x00 && can_id != 0x202) {  // 0x202 doesn't use CRC
+    int slot = crc_registry_find(can_id);
+    if (slot < 0) {
         // Unsupported ID or no CRC needed
         return;
     }
     
     // Update counter (lower 4 bits of byte 1)
-    uint8_t counter = pkt_counters[can_id];
-    data[1] = (data[1] & 0xF0) | counter;
-    pkt_counters[can_id] = (counter + 1) % 15;
+    data[1] = (data[1] & 0xF0) | tx_counter_next(slot);
     
-    // Calculate CRC (skip if ID 0x202 - backlight doesn't use CRC)
-    if (can_id == 0x202) {
+    // Calculate CRC (skip for counter-only IDs like 0x202 backlight)
+    if (crc_registry[slot].crc_start == 0x00) {
         return;
     }
+    data[0] = crc_compute(crc_registry[slot].crc_start, data, data_len);
+}
+
+/**
+ * Check CRC and rolling counter of a received frame
+ * The counter check accepts both 0-14 and 0-15 wrap-around, and the first
+ * frame of an ID always passes it.
+ * 
+ * @param can_id CAN ID
+ * @param data Frame data (byte 0 CRC, low nibble of byte 1 counter)
+ * @param data_len Frame length
+ * @return BMW_PKT_OK, or the first check that failed
+ */
+bmw_pkt_status_t bmw_verify_pkt(uint16_t can_id, const uint8_t *data, uint8_t data_len) {
+    int slot = crc_registry_find(can_id);
+    if (slot < 0) {
+        return BMW_PKT_UNKNOWN_ID;
+    }
+    if (data_len < 2) {
+        return BMW_PKT_BAD_LENGTH;
+    }
+    if (crc_registry[slot].crc_start != 0x00 &&
+        crc_compute(crc_registry[slot].crc_start, data, data_len) != data[0]) {
+        return BMW_PKT_BAD_CRC;
+    }
     
-    uint8_t crc = crc_start;
-    // Process bytes from index 1 to data_len-1 (CRC is in byte 0)
-    for (int i = 1; i < data_len; i++) {
-        crc = crc_table[crc ^ data[i]];
+    uint8_t counter = data[1] & 0x0F;
+    uint8_t last = rx_counters[slot];
+    rx_counters[slot] = counter;
+    if (last != RX_COUNTER_NONE &&
+        counter != (last + 1) % BMW_COUNTER_MODULO && counter != ((last + 1) & 0x0F)) {
+        return BMW_PKT_COUNTER_SKIP;
+    }
+    return BMW_PKT_OK;
+}
+
+/**
+ * Precompute every frame of a TX cache
+ * Each frame is the template with the variant byte, the counter nibble and the CRC filled in.
+ * 
+ * @param cache Cache description with frames storage
+ * @return false if the description is invalid or the ID has no CRC start value
+ */
+bool bmw_tx_cache_init(bmw_tx_cache_t *cache) {
+    int slot = crc_registry_find(cache->can_id);
+    if (slot < 0 || crc_registry[slot].crc_start == 0x00 || cache->len < 2 || cache->len > 8 ||
+        cache->variant_byte >= cache->len || cache->variant_count == 0) {
+        return false;
+    }
+    uint8_t crc_start = crc_registry[slot].crc_start;
+    
+    for (uint8_t v = 0; v < cache->variant_count; v++) {
+        for (uint8_t counter = 0; counter < BMW_COUNTER_MODULO; counter++) {
+            uint8_t *frame = &cache->frames[((size_t)v * BMW_COUNTER_MODULO + counter) * cache->len];
+            memcpy(frame, cache->template_data, cache->len);
+            frame[cache->variant_byte] = cache->variants[v];
+            frame[1] = (frame[1] & 0xF0) | counter;
+            frame[0] = crc_compute(crc_start, frame, cache->len);
+        }
+    }
+    cache->slot = (uint8_t)slot;
+    return true;
+}
+
+/**
+ * Get the next precomputed frame for a variant and advance the rolling counter
+ * The counter is shared with bmw_update_pkt for the same ID.
+ * 
+ * @return Pointer to cache->len bytes, or NULL if the variant is not in the cache
+ */
+const uint8_t *bmw_tx_cache_next(bmw_tx_cache_t *cache, uint8_t variant) {
+    for (uint8_t v = 0; v < cache->variant_count; v++) {
+        if (cache->variants[v] == variant) {
+            return &cache->frames[((size_t)v * BMW_COUNTER_MODULO + tx_counter_next(cache->slot)) * cache->len];
+        }
     }
-    data[0] = crc;
+    return NULL;
 }
 
 /**
@@ -122,63 +213,108 @@ void bmw_shifter_init(bmw_shifter_state_t *state) {
     state->prev_lever_position = LEVER_POS_CENTER_MIDDLE;
 }
 
+// Gear state machine (from gear-lever.lua LeverPos(), leverUp(), leverDown())
+//
+// Every transition is precomputed at compile time into a dense table indexed by
+// [park pressed][gear][previous lever index][new lever index]. Lever codes are
+// mapped to a dense index (high nibble of the 0x?E codes, 8 = any other value),
+// so a new lever code or rule is a change to the macros below, not to the code path.
+#define LEVER_IDX_OTHER        BMW_LEVER_POS_COUNT      // Unknown lever code
+#define LEVER_IDX_COUNT        (BMW_LEVER_POS_COUNT + 1)
+
+// Lever code for a dense index (0xFF never matches a real code)
+#define SM_LEVER_CODE(idx)     ((idx) < BMW_LEVER_POS_COUNT ? (((idx) << 4) | 0x0E) : 0xFF)
+#define SM_LEVER_INDEX(code)   ((((code) & 0x0F) == 0x0E && ((code) >> 4) < BMW_LEVER_POS_COUNT) ? \
+                                ((code) >> 4) : LEVER_IDX_OTHER)
+
+// Manual gear action, stored above the gear bits of a table entry
+#define SM_MANUAL_NONE         BMW_MANUAL_NONE
+#define SM_MANUAL_INC          BMW_MANUAL_INC
+#define SM_MANUAL_DEC          BMW_MANUAL_DEC
+#define SM_GEAR_MASK           0x07
+#define SM_MANUAL_SHIFT        3
+
+// leverUp(): P -> N, D -> N, N -> R
+#define SM_UP(g)               ((g) == GEAR_P ? GEAR_N : (g) == GEAR_D ? GEAR_N : (g) == GEAR_N ? GEAR_R : (g))
+// leverDown(): P -> D, N -> D, R -> N
+#define SM_DOWN(g)             ((g) == GEAR_P ? GEAR_D : (g) == GEAR_N ? GEAR_D : (g) == GEAR_R ? GEAR_N : (g))
+
+#define SM_NEXT_GEAR(g, p, n) ( \
+    ((n) == LEVER_POS_UP_1 && (p) == LEVER_POS_CENTER_MIDDLE) ? SM_UP(g) : \
+    ((n) == LEVER_POS_UP_2 && (p) == LEVER_POS_UP_1) ? SM_UP(g) : \
+    ((n) == LEVER_POS_DOWN_1 && (p) == LEVER_POS_CENTER_MIDDLE) ? SM_DOWN(g) : \
+    ((n) == LEVER_POS_DOWN_2 && (p) == LEVER_POS_DOWN_1) ? SM_DOWN(g) : \
+    ((n) == LEVER_POS_CENTER_SIDE && (p) == LEVER_POS_CENTER_MIDDLE && (g) == GEAR_D) ? GEAR_M : \
+    ((n) == LEVER_POS_CENTER_MIDDLE && (p) == LEVER_POS_CENTER_SIDE && (g) == GEAR_M) ? GEAR_D : \
+    (g))
+
+// Manual gear changes: side up decrements, side down increments (only from centre side in M)
+#define SM_MANUAL(g, p, n) ( \
+    ((p) != LEVER_POS_CENTER_SIDE || (g) != GEAR_M) ? SM_MANUAL_NONE : \
+    (n) == LEVER_POS_SIDE_UP ? SM_MANUAL_DEC : \
+    (n) == LEVER_POS_SIDE_DOWN ? SM_MANUAL_INC : SM_MANUAL_NONE)
+
+// Park button pressed forces P, otherwise apply the lever rules
+#define SM_ENTRY(park, g, p, n) ((uint8_t)((park) ? GEAR_P : \
+    (SM_NEXT_GEAR(g, SM_LEVER_CODE(p), SM_LEVER_CODE(n)) | \
+     (SM_MANUAL(g, SM_LEVER_CODE(p), SM_LEVER_CODE(n)) << SM_MANUAL_SHIFT))))
+
+#define SM_ROW_NEW(k, g, p) { \
+    SM_ENTRY(k, g, p, 0), SM_ENTRY(k, g, p, 1), SM_ENTRY(k, g, p, 2), SM_ENTRY(k, g, p, 3), \
+    SM_ENTRY(k, g, p, 4), SM_ENTRY(k, g, p, 5), SM_ENTRY(k, g, p, 6), SM_ENTRY(k, g, p, 7), \
+    SM_ENTRY(k, g, p, 8) }
+#define SM_ROW_PREV(k, g) { \
+    SM_ROW_NEW(k, g, 0), SM_ROW_NEW(k, g, 1), SM_ROW_NEW(k, g, 2), SM_ROW_NEW(k, g, 3), \
+    SM_ROW_NEW(k, g, 4), SM_ROW_NEW(k, g, 5), SM_ROW_NEW(k, g, 6), SM_ROW_NEW(k, g, 7), \
+    SM_ROW_NEW(k, g, 8) }
+#define SM_ROW_GEAR(k) { \
+    SM_ROW_PREV(k, GEAR_P), SM_ROW_PREV(k, GEAR_R), SM_ROW_PREV(k, GEAR_N), \
+    SM_ROW_PREV(k, GEAR_D), SM_ROW_PREV(k, GEAR_M) }
+
+static const uint8_t transition_table[2][BMW_GEAR_COUNT][LEVER_IDX_COUNT][LEVER_IDX_COUNT] = {
+    SM_ROW_GEAR(0),
+    SM_ROW_GEAR(1),
+};
+
+#define SM_IDX4(c)   SM_LEVER_INDEX(c), SM_LEVER_INDEX((c) + 1), SM_LEVER_INDEX((c) + 2), SM_LEVER_INDEX((c) + 3)
+#define SM_IDX16(c)  SM_IDX4(c), SM_IDX4((c) + 4), SM_IDX4((c) + 8), SM_IDX4((c) + 12)
+#define SM_IDX64(c)  SM_IDX16(c), SM_IDX16((c) + 16), SM_IDX16((c) + 32), SM_IDX16((c) + 48)
+
+// Raw lever byte -> dense lever index
+static const uint8_t lever_index_table[256] = {
+    SM_IDX64(0), SM_IDX64(64), SM_IDX64(128), SM_IDX64(192)
+};
+
+static const uint8_t lever_up_table[BMW_GEAR_COUNT] = {
+    SM_UP(GEAR_P), SM_UP(GEAR_R), SM_UP(GEAR_N), SM_UP(GEAR_D), SM_UP(GEAR_M)
+};
+
+static const uint8_t lever_down_table[BMW_GEAR_COUNT] = {
+    SM_DOWN(GEAR_P), SM_DOWN(GEAR_R), SM_DOWN(GEAR_N), SM_DOWN(GEAR_D), SM_DOWN(GEAR_M)
+};
+
 /**
  * Process lever position change and update gear state
- * Based on gear-lever.lua LeverPos() function
+ * Based on gear-lever.lua LeverPos() function, one table lookup per frame
+ * 
+ * @return Manual gear change made by this frame (BMW_MANUAL_NONE outside M mode)
  */
-void bmw_process_lever_position(bmw_shifter_state_t *state, uint8_t lever_pos, uint8_t park_button) {
-    // Check park button first
-    if (park_button == PARK_BUTTON_PRESSED) {
-        state->current_gear = GEAR_P;
-        state->lever_position = lever_pos;
-        state->park_button = park_button;
-        state->prev_lever_position = lever_pos;
-        return;
-    }
+bmw_manual_shift_t bmw_process_lever_position(bmw_shifter_state_t *state, uint8_t lever_pos, uint8_t park_button) {
+    uint8_t entry = transition_table[park_button == PARK_BUTTON_PRESSED]
+                                    [state->current_gear]
+                                    [lever_index_table[state->prev_lever_position]]
+                                    [lever_index_table[lever_pos]];
+    uint8_t action = entry >> SM_MANUAL_SHIFT;
     
-    uint8_t prev = state->prev_lever_position;
-    
-    // Handle lever up movements
-    if (lever_pos == LEVER_POS_UP_1 && prev == LEVER_POS_CENTER_MIDDLE) {
-        bmw_lever_up(state);
-    } else if (lever_pos == LEVER_POS_UP_2 && prev == LEVER_POS_UP_1) {
-        bmw_lever_up(state);
-    }
-    // Handle lever down movements
-    else if (lever_pos == LEVER_POS_DOWN_1 && prev == LEVER_POS_CENTER_MIDDLE) {
-        bmw_lever_down(state);
-    } else if (lever_pos == LEVER_POS_DOWN_2 && prev == LEVER_POS_DOWN_1) {
-        bmw_lever_down(state);
-    }
-    // Handle side movement (manual mode)
-    else if (lever_pos == LEVER_POS_CENTER_SIDE && prev == LEVER_POS_CENTER_MIDDLE && state->current_gear == GEAR_D) {
-        state->current_gear = GEAR_M;
-    } else if (lever_pos == LEVER_POS_CENTER_MIDDLE && prev == LEVER_POS_CENTER_SIDE && state->current_gear == GEAR_M) {
-        state->current_gear = GEAR_D;
-    }
-    // Handle manual gear changes
-    else if (prev == LEVER_POS_CENTER_SIDE && state->current_gear == GEAR_M) {
-        if (lever_pos == LEVER_POS_SIDE_UP) {
-            if (state->manual_gear > 0) {
-                state->manual_gear--;
-            }
-        } else if (lever_pos == LEVER_POS_SIDE_DOWN) {
-            state->manual_gear++;
-        }
-    }
-    // If lever returned to center, maintain current gear but update position
-    else if (lever_pos == LEVER_POS_CENTER_MIDDLE && prev != LEVER_POS_CENTER_MIDDLE) {
-        // Lever returned to center - maintain current gear
-        // This handles the case when lever is released back to center
-    }
+    state->current_gear = (bmw_gear_t)(entry & SM_GEAR_MASK);
+    state->manual_gear += (action == SM_MANUAL_INC);
+    state->manual_gear -= (action == SM_MANUAL_DEC) & (state->manual_gear > 0);
     
     state->lever_position = lever_pos;
     state->park_button = park_button;
-    
-    // Only update prev_lever_position if lever actually moved
-    if (lever_pos != prev) {
-        state->prev_lever_position = lever_pos;
-    }
+    // prev_lever_position only changes when the lever actually moved, which is the same as always copying it
+    state->prev_lever_position = lever_pos;
+    return (bmw_manual_shift_t)action;
 }
 
 /**
@@ -186,13 +322,7 @@ void bmw_process_lever_position(bmw_shifter_state_t *state, uint8_t lever_pos, u
  * Based on gear-lever.lua leverUp() function
  */
 void bmw_lever_up(bmw_shifter_state_t *state) {
-    if (state->current_gear == GEAR_P) {
-        state->current_gear = GEAR_N;  // P -> N
-    } else if (state->current_gear == GEAR_D) {
-        state->current_gear = GEAR_N;  // D -> N
-    } else if (state->current_gear == GEAR_N) {
-        state->current_gear = GEAR_R;  // N -> R
-    }
+    state->current_gear = (bmw_gear_t)lever_up_table[state->current_gear];
 }
 
 /**
@@ -200,12 +330,53 @@ void bmw_lever_up(bmw_shifter_state_t *state) {
  * Based on gear-lever.lua leverDown() function
  */
 void bmw_lever_down(bmw_shifter_state_t *state) {
-    if (state->current_gear == GEAR_P) {
-        state->current_gear = GEAR_D;  // P -> D
-    } else if (state->current_gear == GEAR_N) {
-        state->current_gear = GEAR_D;  // N -> D
-    } else if (state->current_gear == GEAR_R) {
-        state->current_gear = GEAR_N;  // R -> N
+    state->current_gear = (bmw_gear_t)lever_down_table[state->current_gear];
+}
+
+void bmw_state_snapshot_init(bmw_state_snapshot_t *snap, const bmw_shifter_state_t *state) {
+    atomic_init(&snap->seq, 0);
+    for (size_t i = 0; i < BMW_STATE_SNAPSHOT_WORDS; i++) {
+        atomic_init(&snap->words[i], 0);
+    }
+    bmw_state_snapshot_publish(snap, state);
+}
+
+/**
+ * Publish a new state (single writer, wait-free)
+ * The state is copied word by word with relaxed atomics between two sequence bumps.
+ */
+void bmw_state_snapshot_publish(bmw_state_snapshot_t *snap, const bmw_shifter_state_t *state) {
+    uint32_t buf[BMW_STATE_SNAPSHOT_WORDS] = {0};
+    memcpy(buf, state, sizeof(*state));
+
+    uint32_t seq = atomic_load_explicit(&snap->seq, memory_order_relaxed);
+    atomic_store_explicit(&snap->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);  // Odd sequence is visible before any word changes
+    for (size_t i = 0; i < BMW_STATE_SNAPSHOT_WORDS; i++) {
+        atomic_store_explicit(&snap->words[i], buf[i], memory_order_relaxed);
     }
+    atomic_store_explicit(&snap->seq, seq + 2, memory_order_release);
 }
 
+/**
+ * Copy the latest published state (any task, lock-free)
+ *
+ * @return Sequence number of the copy, it changes with every publish
+ */
+uint32_t bmw_state_snapshot_read(bmw_state_snapshot_t *snap, bmw_shifter_state_t *state) {
+    uint32_t buf[BMW_STATE_SNAPSHOT_WORDS];
+    uint32_t before;
+    uint32_t after;
+
+    do {
+        before = atomic_load_explicit(&snap->seq, memory_order_acquire);
+        for (size_t i = 0; i < BMW_STATE_SNAPSHOT_WORDS; i++) {
+            buf[i] = atomic_load_explicit(&snap->words[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);  // Words are read before the sequence is checked again
+        after = atomic_load_explicit(&snap->seq, memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+
+    memcpy(state, buf, sizeof(*state));
+    return before;
+}
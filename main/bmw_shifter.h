@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -37,6 +38,9 @@ typedef enum {
     GEAR_M = 4   // Manual
 } bmw_gear_t;
 
+#define BMW_GEAR_COUNT                 5
+#define BMW_LEVER_POS_COUNT            8     // Lever codes 0x0E..0x7E (high nibble 0-7)
+
 // Gear indication values (for display)
 #define GEAR_IND_P                     0x20  // Park indication
 #define GEAR_IND_R                     0x40  // Reverse indication
@@ -54,6 +58,14 @@ typedef enum {
 #define TIMING_BACKLIGHT_MS            1000  // Backlight message interval
 #define TIMING_HEARTBEAT_MS            640   // Heartbeat message interval
 #define TIMING_GEAR_LEVER_RX_MS        30    // Expected gear lever position message interval
+#define TIMING_SHIFTER_LOSS_MS         2000  // No 0x197/0x55E for this long - shifter lost
+
+// Manual gear change made by one lever frame (M mode, from centre side)
+typedef enum {
+    BMW_MANUAL_NONE = 0,
+    BMW_MANUAL_INC,              // Lever side down: manual_gear + 1
+    BMW_MANUAL_DEC               // Lever side up: manual_gear - 1
+} bmw_manual_shift_t;
 
 // Shifter state structure
 typedef struct {
@@ -64,6 +76,16 @@ typedef struct {
     uint8_t prev_lever_position;  // Previous lever position for state machine
 } bmw_shifter_state_t;
 
+// Seqlock snapshot of the shifter state for readers in other tasks
+// One task publishes (wait-free, never blocks the CAN RX path); readers copy a
+// consistent state without a lock and retry only if a publish overlapped the copy.
+#define BMW_STATE_SNAPSHOT_WORDS       ((sizeof(bmw_shifter_state_t) + 3) / 4)
+
+typedef struct {
+    atomic_uint_least32_t seq;    // Odd while a publish is in progress
+    atomic_uint_least32_t words[BMW_STATE_SNAPSHOT_WORDS];
+} bmw_state_snapshot_t;
+
 // CAN message structure for gear lever position (ID 0x197)
 // Byte 0: CRC (calculated)
 // Byte 1: Counter (lower 4 bits) | other bits
@@ -110,13 +132,46 @@ typedef struct {
     uint8_t magic;
 } __attribute__((packed)) heartbeat_msg_t;
 
+// Rolling counter in byte 1 of CRC-protected frames runs 0..14
+#define BMW_COUNTER_MODULO             15
+
+// Precomputed CRC-protected TX frames
+// Holds one ready-to-send frame per (variant, counter) pair, so sending a
+// periodic frame is a table index instead of a CRC computation.
+// frames must point to variant_count * BMW_COUNTER_MODULO * len bytes.
+typedef struct {
+    uint16_t can_id;
+    const uint8_t *template_data;  // Frame template (byte 0 CRC and counter nibble are filled in)
+    uint8_t len;                   // Frame length in bytes (2-8)
+    uint8_t variant_byte;          // Index of the byte that differs between variants
+    const uint8_t *variants;       // Possible values of the variant byte
+    uint8_t variant_count;
+    uint8_t *frames;               // Precomputed frames [variant][counter][len]
+    uint8_t slot;                  // CRC registry slot (set by bmw_tx_cache_init)
+} bmw_tx_cache_t;
+
+// Result of checking a received CRC-protected frame
+typedef enum {
+    BMW_PKT_OK = 0,
+    BMW_PKT_UNKNOWN_ID,     // ID not in the CRC registry
+    BMW_PKT_BAD_LENGTH,     // Too short to carry CRC and counter
+    BMW_PKT_BAD_CRC,        // CRC mismatch
+    BMW_PKT_COUNTER_SKIP    // CRC ok, but counter did not advance by one (lost or repeated frame)
+} bmw_pkt_status_t;
+
 // Function declarations
 void bmw_update_pkt(uint16_t can_id, uint8_t *data, uint8_t data_len);
+bmw_pkt_status_t bmw_verify_pkt(uint16_t can_id, const uint8_t *data, uint8_t data_len);
 uint8_t bmw_get_gear_indication(bmw_gear_t gear);
 void bmw_shifter_init(bmw_shifter_state_t *state);
-void bmw_process_lever_position(bmw_shifter_state_t *state, uint8_t lever_pos, uint8_t park_button);
+bmw_manual_shift_t bmw_process_lever_position(bmw_shifter_state_t *state, uint8_t lever_pos, uint8_t park_button);
 void bmw_lever_up(bmw_shifter_state_t *state);
 void bmw_lever_down(bmw_shifter_state_t *state);
+void bmw_state_snapshot_init(bmw_state_snapshot_t *snap, const bmw_shifter_state_t *state);
+void bmw_state_snapshot_publish(bmw_state_snapshot_t *snap, const bmw_shifter_state_t *state);
+uint32_t bmw_state_snapshot_read(bmw_state_snapshot_t *snap, bmw_shifter_state_t *state);
+bool bmw_tx_cache_init(bmw_tx_cache_t *cache);
+const uint8_t *bmw_tx_cache_next(bmw_tx_cache_t *cache, uint8_t variant);
 
 #ifdef __cplusplus
 }
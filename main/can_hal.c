@@ -0,0 +1,180 @@
+#include "can_hal.h"
+#include <string.h>
+
+// Active backend (set once at startup, before any task uses the bus)
+static const can_hal_backend_t *active_backend = &can_hal_virtual_backend;
+
+// Whitelist (set once at startup) and per-ID counters (only touched by the receiving task)
+static uint32_t filter_ids[CAN_HAL_FILTER_MAX_IDS];
+static size_t filter_count = 0;
+static can_hal_id_stats_t id_stats[CAN_HAL_STATS_SLOTS];
+static bool id_stats_used[CAN_HAL_STATS_SLOTS];
+static uint32_t untracked_frames = 0;
+
+void can_hal_set_backend(const can_hal_backend_t *backend) {
+    if (backend != NULL) {
+        active_backend = backend;
+    }
+}
+
+const can_hal_backend_t *can_hal_get_backend(void) {
+    return active_backend;
+}
+
+/**
+ * Set the RX whitelist (standard IDs), count 0 accepts everything
+ * Must be called before the backend is started for hardware filtering to apply.
+ */
+bool can_hal_set_filter(const uint32_t *ids, size_t count) {
+    if (count > CAN_HAL_FILTER_MAX_IDS || (count > 0 && ids == NULL)) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (ids[i] > 0x7FF) {
+            return false;
+        }
+        filter_ids[i] = ids[i];
+    }
+    filter_count = count;
+    return true;
+}
+
+size_t can_hal_get_filter(const uint32_t **ids) {
+    if (ids != NULL) {
+        *ids = filter_ids;
+    }
+    return filter_count;
+}
+
+bool can_hal_filter_accepts(uint32_t id, uint8_t flags) {
+    if (filter_count == 0) {
+        return true;
+    }
+    if (flags & CAN_FRAME_FLAG_EXTD) {
+        return false;
+    }
+    for (size_t i = 0; i < filter_count; i++) {
+        if (filter_ids[i] == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Find or claim the counter slot for an ID (open addressing), NULL when the table is full
+static can_hal_id_stats_t *id_stats_slot(uint32_t id) {
+    uint32_t slot = (id * 0x9E3779B1u) >> 27;  // Top 5 bits -> 0..31
+    for (uint32_t probe = 0; probe < CAN_HAL_STATS_SLOTS; probe++) {
+        uint32_t i = (slot + probe) & (CAN_HAL_STATS_SLOTS - 1);
+        if (!id_stats_used[i]) {
+            id_stats_used[i] = true;
+            id_stats[i].id = id;
+            return &id_stats[i];
+        }
+        if (id_stats[i].id == id) {
+            return &id_stats[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Receive the next frame that passes the whitelist
+ * Rejected frames are counted and skipped; each wait uses the full timeout.
+ */
+can_hal_status_t can_hal_receive(can_frame_t *frame, uint32_t timeout_ms) {
+    if (frame == NULL) {
+        return CAN_HAL_ERR_INVALID_ARG;
+    }
+    while (1) {
+        can_hal_status_t ret = active_backend->receive(frame, timeout_ms);
+        if (ret != CAN_HAL_OK) {
+            return ret;
+        }
+        bool accepted = can_hal_filter_accepts(frame->id, frame->flags);
+        can_hal_id_stats_t *stats = id_stats_slot(frame->id);
+        if (stats == NULL) {
+            untracked_frames++;
+        } else if (accepted) {
+            stats->accepted++;
+        } else {
+            stats->rejected++;
+        }
+        if (accepted) {
+            return CAN_HAL_OK;
+        }
+    }
+}
+
+/**
+ * Copy the per-ID counters, returns the number of entries written
+ * untracked (optional) receives the count of frames whose ID did not fit in the table.
+ */
+size_t can_hal_get_id_stats(can_hal_id_stats_t *stats, size_t max_count, uint32_t *untracked) {
+    size_t n = 0;
+    for (size_t i = 0; i < CAN_HAL_STATS_SLOTS && n < max_count; i++) {
+        if (id_stats_used[i]) {
+            stats[n++] = id_stats[i];
+        }
+    }
+    if (untracked != NULL) {
+        *untracked = untracked_frames;
+    }
+    return n;
+}
+
+void can_hal_reset_stats(void) {
+    memset(id_stats, 0, sizeof(id_stats));
+    memset(id_stats_used, 0, sizeof(id_stats_used));
+    untracked_frames = 0;
+}
+
+can_hal_status_t can_hal_transmit(const can_frame_t *frame, uint32_t timeout_ms) {
+    if (frame == NULL || frame->dlc > 8) {
+        return CAN_HAL_ERR_INVALID_ARG;
+    }
+    return active_backend->transmit(frame, timeout_ms);
+}
+
+/**
+ * Wait up to timeout_ms for transmitted frames to complete
+ * done / failed receive the number of frames that finished since the previous call,
+ * in the order they were submitted. Returns CAN_HAL_ERR_TIMEOUT if none finished.
+ */
+can_hal_status_t can_hal_tx_wait(uint32_t timeout_ms, uint32_t *done, uint32_t *failed) {
+    if (done == NULL || failed == NULL) {
+        return CAN_HAL_ERR_INVALID_ARG;
+    }
+    *done = 0;
+    *failed = 0;
+    if (active_backend->tx_wait == NULL) {
+        return CAN_HAL_ERR_NOT_READY;
+    }
+    return active_backend->tx_wait(timeout_ms, done, failed);
+}
+
+/**
+ * Read the backend's RX loss counters (CAN_HAL_ERR_NOT_READY if it has none)
+ */
+can_hal_status_t can_hal_get_rx_loss(can_hal_rx_loss_t *loss) {
+    if (loss == NULL) {
+        return CAN_HAL_ERR_INVALID_ARG;
+    }
+    loss->queue_full = 0;
+    loss->fifo_overrun = 0;
+    if (active_backend->rx_loss == NULL) {
+        return CAN_HAL_ERR_NOT_READY;
+    }
+    return active_backend->rx_loss(loss);
+}
+
+const char *can_hal_status_name(can_hal_status_t status) {
+    switch (status) {
+        case CAN_HAL_OK: return "OK";
+        case CAN_HAL_ERR_TIMEOUT: return "TIMEOUT";
+        case CAN_HAL_ERR_NOT_READY: return "NOT_READY";
+        case CAN_HAL_ERR_INVALID_ARG: return "INVALID_ARG";
+        case CAN_HAL_ERR_FAIL: return "FAIL";
+        default: return "UNKNOWN";
+    }
+}
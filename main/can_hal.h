@@ -0,0 +1,112 @@
+#ifndef CAN_HAL_H
+#define CAN_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frame flags
+#define CAN_FRAME_FLAG_EXTD            0x01  // 29-bit identifier
+#define CAN_FRAME_FLAG_RTR             0x02  // Remote transmission request
+
+// Bus-independent CAN frame
+typedef struct {
+    uint32_t id;             // 11 or 29 bit identifier
+    uint8_t dlc;             // Data length code (0-8)
+    uint8_t flags;           // CAN_FRAME_FLAG_*
+    uint8_t data[8];
+    uint64_t timestamp_us;   // Receive time (backend clock), 0 if unknown
+} can_frame_t;
+
+// Result codes
+typedef enum {
+    CAN_HAL_OK = 0,
+    CAN_HAL_ERR_TIMEOUT,     // Nothing received / TX queue full within the timeout
+    CAN_HAL_ERR_NOT_READY,   // Backend not installed or stopped
+    CAN_HAL_ERR_INVALID_ARG,
+    CAN_HAL_ERR_FAIL
+} can_hal_status_t;
+
+// Frames lost on the receive side before can_hal_receive() could see them
+typedef struct {
+    uint32_t queue_full;     // Driver RX queue was full (TWAI rx_missed_count)
+    uint32_t fifo_overrun;   // Controller RX FIFO overrun (TWAI rx_overrun_count)
+} can_hal_rx_loss_t;
+
+// Backend interface
+typedef struct {
+    const char *name;
+    can_hal_status_t (*receive)(can_frame_t *frame, uint32_t timeout_ms);
+    can_hal_status_t (*transmit)(const can_frame_t *frame, uint32_t timeout_ms);
+    // Wait for TX completions, reports frames finished since the last call (optional)
+    can_hal_status_t (*tx_wait)(uint32_t timeout_ms, uint32_t *done, uint32_t *failed);
+    // RX loss counters since start (optional)
+    can_hal_status_t (*rx_loss)(can_hal_rx_loss_t *loss);
+} can_hal_backend_t;
+
+// RX acceptance filter - whitelist of standard (11-bit) IDs
+// Backends that can filter in hardware program it at start; can_hal_receive()
+// always re-checks it in software. An empty whitelist accepts everything (sniffer mode).
+#define CAN_HAL_FILTER_MAX_IDS         8
+
+// Per-ID receive counters (IDs beyond the table are only counted in total)
+#define CAN_HAL_STATS_SLOTS            32
+
+typedef struct {
+    uint32_t id;
+    uint32_t accepted;       // Delivered to the caller
+    uint32_t rejected;       // Reached the CPU but not on the whitelist
+} can_hal_id_stats_t;
+
+// Available backends
+extern const can_hal_backend_t can_hal_virtual_backend;
+#ifdef ESP_PLATFORM
+extern const can_hal_backend_t can_hal_twai_backend;
+#endif
+
+// Function declarations
+void can_hal_set_backend(const can_hal_backend_t *backend);
+const can_hal_backend_t *can_hal_get_backend(void);
+can_hal_status_t can_hal_receive(can_frame_t *frame, uint32_t timeout_ms);
+can_hal_status_t can_hal_transmit(const can_frame_t *frame, uint32_t timeout_ms);
+can_hal_status_t can_hal_tx_wait(uint32_t timeout_ms, uint32_t *done, uint32_t *failed);
+can_hal_status_t can_hal_get_rx_loss(can_hal_rx_loss_t *loss);
+const char *can_hal_status_name(can_hal_status_t status);
+bool can_hal_set_filter(const uint32_t *ids, size_t count);
+size_t can_hal_get_filter(const uint32_t **ids);
+bool can_hal_filter_accepts(uint32_t id, uint8_t flags);
+size_t can_hal_get_id_stats(can_hal_id_stats_t *stats, size_t max_count, uint32_t *untracked);
+void can_hal_reset_stats(void);
+
+#ifdef ESP_PLATFORM
+// TWAI backend setup (ESP-IDF only), programs the acceptance filter from can_hal_set_filter()
+esp_err_t can_hal_twai_start(int tx_gpio, int rx_gpio);
+#endif
+
+// Virtual bus - replays recorded logs as RX traffic and captures everything transmitted
+typedef enum {
+    CAN_VIRTUAL_PACE_MAX_SPEED = 0,  // Deliver frames as fast as they are received
+    CAN_VIRTUAL_PACE_REALTIME        // Deliver frames at their recorded timestamps
+} can_virtual_pace_t;
+
+void can_virtual_reset(void);
+bool can_virtual_load_log(const char *path);
+bool can_virtual_inject(const can_frame_t *frame);
+void can_virtual_set_pace(can_virtual_pace_t pace);
+size_t can_virtual_rx_pending(void);
+size_t can_virtual_tx_count(void);
+const can_frame_t *can_virtual_tx_frames(void);
+void can_virtual_tx_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CAN_HAL_H
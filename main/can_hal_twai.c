@@ -0,0 +1,164 @@
+#include "can_hal.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/twai.h"
+
+static const char *TAG = "CAN_HAL_TWAI";
+
+static can_hal_status_t twai_status_from_err(esp_err_t err) {
+    switch (err) {
+        case ESP_OK: return CAN_HAL_OK;
+        case ESP_ERR_TIMEOUT: return CAN_HAL_ERR_TIMEOUT;
+        case ESP_ERR_INVALID_STATE: return CAN_HAL_ERR_NOT_READY;
+        case ESP_ERR_INVALID_ARG: return CAN_HAL_ERR_INVALID_ARG;
+        default: return CAN_HAL_ERR_FAIL;
+    }
+}
+
+#define TWAI_RX_QUEUE_LEN  32
+#define TWAI_TX_QUEUE_LEN  8
+
+// TX completion tracking (only the transmitting task uses these)
+static uint32_t tx_submitted = 0;       // Frames accepted by twai_transmit
+static uint32_t tx_reported = 0;        // Frames already returned by tx_wait
+static uint32_t tx_failed_reported = 0; // Controller tx_failed_count at the last tx_wait
+
+// Acceptance filter for the HAL whitelist (standard frames, mask bit 1 = don't care)
+// One or two IDs: dual filter mode, one exact ID per filter (RTR and data bits ignored).
+// More IDs: single filter matching the bits they share, the software filter drops the rest.
+static twai_filter_config_t twai_filter_from_whitelist(void) {
+    const uint32_t *ids;
+    size_t count = can_hal_get_filter(&ids);
+    if (count == 0) {
+        twai_filter_config_t accept_all = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+        return accept_all;
+    }
+
+    twai_filter_config_t f_config = {0};
+    if (count <= 2) {
+        uint32_t id2 = count == 2 ? ids[1] : ids[0];
+        // Filter 1: bits 31-21 ID, 20 RTR, 19-16 and 3-0 data byte 0; filter 2: bits 15-5 ID, 4 RTR
+        f_config.acceptance_code = (ids[0] << 21) | (id2 << 5);
+        f_config.acceptance_mask = 0x001F001F;
+        f_config.single_filter = false;
+    } else {
+        uint32_t differing = 0;
+        for (size_t i = 1; i < count; i++) {
+            differing |= ids[i] ^ ids[0];
+        }
+        // Bits 31-21 ID, 20 RTR, 19-0 data bytes 0-1
+        f_config.acceptance_code = ids[0] << 21;
+        f_config.acceptance_mask = (differing << 21) | 0x001FFFFF;
+        f_config.single_filter = true;
+    }
+    return f_config;
+}
+
+/**
+ * Install and start the TWAI driver at 500 kbit/s (PT-CAN)
+ */
+esp_err_t can_hal_twai_start(int tx_gpio, int rx_gpio) {
+    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT((gpio_num_t)tx_gpio, (gpio_num_t)rx_gpio, TWAI_MODE_NORMAL);
+    twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
+    twai_filter_config_t f_config = twai_filter_from_whitelist();
+    g_config.rx_queue_len = TWAI_RX_QUEUE_LEN;
+    g_config.tx_queue_len = TWAI_TX_QUEUE_LEN;
+    g_config.alerts_enabled = TWAI_ALERT_TX_SUCCESS | TWAI_ALERT_TX_FAILED;
+
+    esp_err_t ret = twai_driver_install(&g_config, &t_config, &f_config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to install TWAI driver: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    ret = twai_start();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start TWAI driver: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    ESP_LOGI(TAG, "TWAI driver started. TX GPIO: %d, RX GPIO: %d", tx_gpio, rx_gpio);
+    if (can_hal_get_filter(NULL) == 0) {
+        ESP_LOGI(TAG, "RX filter: accept all (sniffer)");
+    } else {
+        ESP_LOGI(TAG, "RX filter: %s code 0x%08lX mask 0x%08lX",
+                 f_config.single_filter ? "single" : "dual",
+                 (unsigned long)f_config.acceptance_code, (unsigned long)f_config.acceptance_mask);
+    }
+    return ESP_OK;
+}
+
+static can_hal_status_t twai_backend_receive(can_frame_t *frame, uint32_t timeout_ms) {
+    twai_message_t msg;
+    esp_err_t ret = twai_receive(&msg, pdMS_TO_TICKS(timeout_ms));
+    if (ret != ESP_OK) {
+        return twai_status_from_err(ret);
+    }
+
+    frame->id = msg.identifier;
+    frame->dlc = msg.data_length_code > 8 ? 8 : msg.data_length_code;
+    frame->flags = (msg.extd ? CAN_FRAME_FLAG_EXTD : 0) | (msg.rtr ? CAN_FRAME_FLAG_RTR : 0);
+    memcpy(frame->data, msg.data, sizeof(frame->data));
+    frame->timestamp_us = (uint64_t)esp_timer_get_time();
+    return CAN_HAL_OK;
+}
+
+static can_hal_status_t twai_backend_transmit(const can_frame_t *frame, uint32_t timeout_ms) {
+    twai_message_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.identifier = frame->id;
+    msg.extd = (frame->flags & CAN_FRAME_FLAG_EXTD) ? 1 : 0;
+    msg.rtr = (frame->flags & CAN_FRAME_FLAG_RTR) ? 1 : 0;
+    msg.data_length_code = frame->dlc;
+    memcpy(msg.data, frame->data, frame->dlc);
+
+    esp_err_t ret = twai_transmit(&msg, pdMS_TO_TICKS(timeout_ms));
+    if (ret == ESP_OK) {
+        tx_submitted++;
+    }
+    return twai_status_from_err(ret);
+}
+
+// Alerts are latched bits, so the completion count comes from the driver's TX backlog
+static can_hal_status_t twai_backend_tx_wait(uint32_t timeout_ms, uint32_t *done, uint32_t *failed) {
+    uint32_t alerts = 0;
+    esp_err_t ret = twai_read_alerts(&alerts, pdMS_TO_TICKS(timeout_ms));
+    if (ret != ESP_OK && ret != ESP_ERR_TIMEOUT) {
+        return twai_status_from_err(ret);
+    }
+
+    twai_status_info_t status;
+    ret = twai_get_status_info(&status);
+    if (ret != ESP_OK) {
+        return twai_status_from_err(ret);
+    }
+    uint32_t finished = (tx_submitted - status.msgs_to_tx) - tx_reported;
+    uint32_t new_failed = status.tx_failed_count - tx_failed_reported;
+    if (new_failed > finished) {
+        new_failed = finished;
+    }
+    tx_reported += finished;
+    tx_failed_reported += new_failed;
+    *failed = new_failed;
+    *done = finished - new_failed;
+    return finished > 0 ? CAN_HAL_OK : CAN_HAL_ERR_TIMEOUT;
+}
+
+static can_hal_status_t twai_backend_rx_loss(can_hal_rx_loss_t *loss) {
+    twai_status_info_t status;
+    esp_err_t ret = twai_get_status_info(&status);
+    if (ret != ESP_OK) {
+        return twai_status_from_err(ret);
+    }
+    loss->queue_full = status.rx_missed_count;
+    loss->fifo_overrun = status.rx_overrun_count;
+    return CAN_HAL_OK;
+}
+
+const can_hal_backend_t can_hal_twai_backend = {
+    .name = "twai",
+    .receive = twai_backend_receive,
+    .transmit = twai_backend_transmit,
+    .tx_wait = twai_backend_tx_wait,
+    .rx_loss = twai_backend_rx_loss,
+};
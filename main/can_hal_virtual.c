@@ -0,0 +1,297 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "can_hal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+// In-process virtual bus
+// RX side: frames loaded from candump / Vector ASC logs or injected by the caller,
+// delivered either as fast as possible or paced by their recorded timestamps.
+// TX side: every transmitted frame is appended to a capture buffer.
+// Not thread-safe: one receiver and one transmitter context at a time.
+
+typedef struct {
+    can_frame_t *frames;
+    size_t count;
+    size_t capacity;
+} frame_buffer_t;
+
+static frame_buffer_t rx_frames;
+static size_t rx_next = 0;
+static frame_buffer_t tx_frames;
+static can_virtual_pace_t pace = CAN_VIRTUAL_PACE_MAX_SPEED;
+static uint64_t replay_start_us = 0;   // Wall clock at first paced receive (0 = not started)
+static uint64_t replay_time_us = 0;    // Log timestamp of the last delivered frame
+static uint32_t tx_unreported = 0;     // Transmitted frames not yet returned by tx_wait
+
+static bool frame_buffer_push(frame_buffer_t *buf, const can_frame_t *frame) {
+    if (buf->count == buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity * 2 : 256;
+        can_frame_t *frames = realloc(buf->frames, capacity * sizeof(can_frame_t));
+        if (frames == NULL) {
+            return false;
+        }
+        buf->frames = frames;
+        buf->capacity = capacity;
+    }
+    buf->frames[buf->count++] = *frame;
+    return true;
+}
+
+static uint64_t wall_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000ull;
+}
+
+static void sleep_us(uint64_t us) {
+    struct timespec ts = {
+        .tv_sec = (time_t)(us / 1000000ull),
+        .tv_nsec = (long)(us % 1000000ull) * 1000L,
+    };
+    nanosleep(&ts, NULL);
+}
+
+// Parse "<id>#<hex data>" (candump -l / -L), returns false on RTR or malformed input
+static bool parse_candump_payload(const char *s, can_frame_t *frame) {
+    char *end;
+    unsigned long id = strtoul(s, &end, 16);
+    if (*end != '#') {
+        return false;
+    }
+    frame->flags = (end - s) > 3 ? CAN_FRAME_FLAG_EXTD : 0;
+    frame->id = (uint32_t)id;
+    s = end + 1;
+    if (*s == 'R') {
+        return false;  // Remote frames carry no data, skip them
+    }
+    frame->dlc = 0;
+    while (isxdigit((unsigned char)s[0]) && isxdigit((unsigned char)s[1]) && frame->dlc < 8) {
+        char byte[3] = {s[0], s[1], 0};
+        frame->data[frame->dlc++] = (uint8_t)strtoul(byte, NULL, 16);
+        s += 2;
+    }
+    return true;
+}
+
+// Parse one log line, returns false for headers, comments and unsupported frames
+static bool parse_log_line(const char *line, can_frame_t *frame, double *timestamp_s) {
+    memset(frame, 0, sizeof(*frame));
+    while (isspace((unsigned char)*line)) {
+        line++;
+    }
+
+    // candump -l / -L: "(1436509052.249713) can0 197#62010EC0"
+    if (line[0] == '(') {
+        char iface[32];
+        char payload[64];
+        if (sscanf(line, "(%lf) %31s %63s", timestamp_s, iface, payload) != 3) {
+            return false;
+        }
+        return parse_candump_payload(payload, frame);
+    }
+
+    // Vector ASC: "0.010000 1  197             Rx   d 4 62 01 0E C0"
+    if (isdigit((unsigned char)line[0])) {
+        char id_str[16];
+        char dir[8];
+        char type[4];
+        int channel;
+        unsigned dlc;
+        int consumed = 0;
+        if (sscanf(line, "%lf %d %15s %7s %3s %u%n", timestamp_s, &channel, id_str, dir, type, &dlc, &consumed) != 6 ||
+            strcmp(type, "d") != 0 || dlc > 8) {
+            return false;
+        }
+        size_t id_len = strlen(id_str);
+        if (id_len > 0 && (id_str[id_len - 1] == 'x' || id_str[id_len - 1] == 'X')) {
+            frame->flags = CAN_FRAME_FLAG_EXTD;
+        }
+        frame->id = (uint32_t)strtoul(id_str, NULL, 16);
+        const char *p = line + consumed;
+        for (unsigned i = 0; i < dlc; i++) {
+            unsigned byte;
+            int n;
+            if (sscanf(p, "%x%n", &byte, &n) != 1) {
+                return false;
+            }
+            frame->data[i] = (uint8_t)byte;
+            p += n;
+        }
+        frame->dlc = (uint8_t)dlc;
+        return true;
+    }
+
+    // candump default output: "can0  197   [4]  62 01 0E C0"
+    char iface[32];
+    char id_str[16];
+    unsigned dlc;
+    int consumed = 0;
+    if (sscanf(line, "%31s %15s [%u]%n", iface, id_str, &dlc, &consumed) == 3 && dlc <= 8) {
+        frame->flags = strlen(id_str) > 3 ? CAN_FRAME_FLAG_EXTD : 0;
+        frame->id = (uint32_t)strtoul(id_str, NULL, 16);
+        const char *p = line + consumed;
+        for (unsigned i = 0; i < dlc; i++) {
+            unsigned byte;
+            int n;
+            if (sscanf(p, "%x%n", &byte, &n) != 1) {
+                return false;
+            }
+            frame->data[i] = (uint8_t)byte;
+            p += n;
+        }
+        frame->dlc = (uint8_t)dlc;
+        *timestamp_s = -1.0;  // No timestamp in this format
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Drop all queued RX frames and captured TX frames
+ */
+void can_virtual_reset(void) {
+    free(rx_frames.frames);
+    free(tx_frames.frames);
+    memset(&rx_frames, 0, sizeof(rx_frames));
+    memset(&tx_frames, 0, sizeof(tx_frames));
+    rx_next = 0;
+    replay_start_us = 0;
+    replay_time_us = 0;
+    tx_unreported = 0;
+}
+
+/**
+ * Append all frames of a candump (-l, -L or default output) or Vector ASC log to the RX queue
+ * Timestamps are made relative to the first frame of the log
+ */
+bool can_virtual_load_log(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+
+    char line[256];
+    double first_ts = -1.0;
+    uint64_t synthetic_ts_us = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f) != NULL) {
+        can_frame_t frame;
+        double ts;
+        if (!parse_log_line(line, &frame, &ts)) {
+            continue;
+        }
+        if (ts < 0.0) {
+            // Untimed log - space frames 1 ms apart
+            frame.timestamp_us = synthetic_ts_us;
+            synthetic_ts_us += 1000;
+        } else {
+            if (first_ts < 0.0) {
+                first_ts = ts;
+            }
+            frame.timestamp_us = (uint64_t)((ts - first_ts) * 1e6 + 0.5);
+        }
+        ok = frame_buffer_push(&rx_frames, &frame);
+    }
+    fclose(f);
+    return ok;
+}
+
+/**
+ * Queue a single RX frame (e.g. from a scripted device)
+ */
+bool can_virtual_inject(const can_frame_t *frame) {
+    return frame != NULL && frame_buffer_push(&rx_frames, frame);
+}
+
+void can_virtual_set_pace(can_virtual_pace_t new_pace) {
+    pace = new_pace;
+    replay_start_us = 0;
+}
+
+size_t can_virtual_rx_pending(void) {
+    return rx_frames.count - rx_next;
+}
+
+size_t can_virtual_tx_count(void) {
+    return tx_frames.count;
+}
+
+const can_frame_t *can_virtual_tx_frames(void) {
+    return tx_frames.frames;
+}
+
+void can_virtual_tx_clear(void) {
+    tx_frames.count = 0;
+}
+
+static can_hal_status_t virtual_receive(can_frame_t *frame, uint32_t timeout_ms) {
+    if (rx_next >= rx_frames.count) {
+        if (pace == CAN_VIRTUAL_PACE_REALTIME) {
+            sleep_us((uint64_t)timeout_ms * 1000ull);
+        }
+        return CAN_HAL_ERR_TIMEOUT;
+    }
+
+    const can_frame_t *next = &rx_frames.frames[rx_next];
+    if (pace == CAN_VIRTUAL_PACE_REALTIME) {
+        uint64_t now = wall_time_us();
+        if (replay_start_us == 0) {
+            replay_start_us = now - next->timestamp_us;
+        }
+        uint64_t due = replay_start_us + next->timestamp_us;
+        if (due > now) {
+            uint64_t wait_us = due - now;
+            if (wait_us > (uint64_t)timeout_ms * 1000ull) {
+                sleep_us((uint64_t)timeout_ms * 1000ull);
+                return CAN_HAL_ERR_TIMEOUT;
+            }
+            sleep_us(wait_us);
+        }
+    }
+
+    *frame = *next;
+    replay_time_us = next->timestamp_us;
+    rx_next++;
+    return CAN_HAL_OK;
+}
+
+static can_hal_status_t virtual_transmit(const can_frame_t *frame, uint32_t timeout_ms) {
+    (void) timeout_ms;
+    can_frame_t captured = *frame;
+    // Stamp with log time so captures line up with the replayed input
+    if (pace == CAN_VIRTUAL_PACE_REALTIME && replay_start_us != 0) {
+        captured.timestamp_us = wall_time_us() - replay_start_us;
+    } else {
+        captured.timestamp_us = replay_time_us;
+    }
+    if (!frame_buffer_push(&tx_frames, &captured)) {
+        return CAN_HAL_ERR_FAIL;
+    }
+    tx_unreported++;
+    return CAN_HAL_OK;
+}
+
+// Virtual frames complete as soon as they are captured
+static can_hal_status_t virtual_tx_wait(uint32_t timeout_ms, uint32_t *done, uint32_t *failed) {
+    *failed = 0;
+    *done = tx_unreported;
+    tx_unreported = 0;
+    if (*done == 0) {
+        if (pace == CAN_VIRTUAL_PACE_REALTIME) {
+            sleep_us((uint64_t)timeout_ms * 1000ull);
+        }
+        return CAN_HAL_ERR_TIMEOUT;
+    }
+    return CAN_HAL_OK;
+}
+
+const can_hal_backend_t can_hal_virtual_backend = {
+    .name = "virtual",
+    .receive = virtual_receive,
+    .transmit = virtual_transmit,
+    .tx_wait = virtual_tx_wait,
+};
@@ -0,0 +1,232 @@
+#include "can_loadgen.h"
+#include <string.h>
+#include "bmw_shifter.h"
+
+#define SHIFTER_HEARTBEAT_PERIOD_US    (TIMING_HEARTBEAT_MS * 1000u)
+
+// Background mix around the shifter's IDs: some win arbitration against 0x197, some lose
+const can_loadgen_stream_t can_loadgen_default_mix[] = {
+    {0x0A5, 8, 10000}, {0x0A7, 8, 10000}, {0x0D9, 8, 20000}, {0x12F, 8, 20000},
+    {0x173, 8, 20000}, {0x1A1, 8, 20000}, {0x1FC, 8, 50000}, {0x254, 8, 50000},
+    {0x2A0, 8, 100000}, {0x3A0, 8, 100000}, {0x3F9, 8, 100000}, {0x510, 8, 200000},
+};
+const size_t can_loadgen_default_mix_count = sizeof(can_loadgen_default_mix) / sizeof(can_loadgen_default_mix[0]);
+
+// Lever script, repeated: P -> R -> N -> D, M with two shifts each way, back to D, Park
+static const struct {
+    uint8_t lever_pos;
+    uint8_t park_button;
+    uint16_t hold_ms;
+} lever_script[] = {
+    {LEVER_POS_CENTER_MIDDLE, PARK_BUTTON_NORMAL, 600},
+    {LEVER_POS_UP_1, PARK_BUTTON_NORMAL, 150},
+    {LEVER_POS_CENTER_MIDDLE, PARK_BUTTON_NORMAL, 450},
+    {LEVER_POS_DOWN_1, PARK_BUTTON_NORMAL, 150},
+    {LEVER_POS_CENTER_MIDDLE, PARK_BUTTON_NORMAL, 450},
+    {LEVER_POS_DOWN_2, PARK_BUTTON_NORMAL, 150},
+    {LEVER_POS_CENTER_MIDDLE, PARK_BUTTON_NORMAL, 450},
+    {LEVER_POS_CENTER_SIDE, PARK_BUTTON_NORMAL, 450},
+    {LEVER_POS_SIDE_UP, PARK_BUTTON_NORMAL, 120},
+    {LEVER_POS_CENTER_SIDE, PARK_BUTTON_NORMAL, 240},
+    {LEVER_POS_SIDE_UP, PARK_BUTTON_NORMAL, 120},
+    {LEVER_POS_CENTER_SIDE, PARK_BUTTON_NORMAL, 240},
+    {LEVER_POS_SIDE_DOWN, PARK_BUTTON_NORMAL, 120},
+    {LEVER_POS_CENTER_SIDE, PARK_BUTTON_NORMAL, 240},
+    {LEVER_POS_SIDE_DOWN, PARK_BUTTON_NORMAL, 120},
+    {LEVER_POS_CENTER_SIDE, PARK_BUTTON_NORMAL, 450},
+    {LEVER_POS_CENTER_MIDDLE, PARK_BUTTON_NORMAL, 450},
+    {LEVER_POS_CENTER_MIDDLE, PARK_BUTTON_PRESSED, 150},
+};
+#define LEVER_SCRIPT_STEPS  (sizeof(lever_script) / sizeof(lever_script[0]))
+
+static uint32_t rng_next(can_loadgen_t *gen) {
+    uint32_t x = gen->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    gen->rng = x;
+    return x;
+}
+
+/**
+ * Worst-case (fully stuffed) frame length on the wire, including interframe space
+ */
+uint32_t can_loadgen_frame_bits(uint8_t dlc, bool extended) {
+    uint32_t payload = 8u * dlc;
+    if (extended) {
+        return 67u + payload + (54u + payload - 1u) / 4u;
+    }
+    return 47u + payload + (34u + payload - 1u) / 4u;
+}
+
+static uint32_t frame_time_us(const can_loadgen_t *gen, uint8_t dlc) {
+    return (can_loadgen_frame_bits(dlc, false) * 1000000u + gen->bitrate - 1) / gen->bitrate;
+}
+
+// Advance the lever script up to time_us
+static void script_advance(can_loadgen_t *gen, uint64_t time_us) {
+    while (time_us >= gen->script_next_us) {
+        gen->script_step = (gen->script_step + 1) % LEVER_SCRIPT_STEPS;
+        gen->lever_pos = lever_script[gen->script_step].lever_pos;
+        gen->park_button = lever_script[gen->script_step].park_button;
+        gen->script_next_us += lever_script[gen->script_step].hold_ms * 1000ull;
+    }
+}
+
+// The sender queues the frame for its current slot
+static void sender_queue(can_loadgen_t *gen, can_loadgen_sender_t *s) {
+    s->queued_us = s->slot_us;
+    if (s->id == CAN_ID_GEAR_LEVER_POSITION) {
+        script_advance(gen, s->slot_us);
+        s->data[0] = 0;
+        s->data[1] = 0;
+        s->data[2] = gen->lever_pos;
+        s->data[3] = gen->park_button;
+        bmw_update_pkt(CAN_ID_GEAR_LEVER_POSITION, s->data, s->dlc);
+    } else if (s->id != CAN_ID_GEAR_LEVER_HEARTBEAT) {
+        if (gen->jitter_us > 0) {
+            s->queued_us += rng_next(gen) % (gen->jitter_us + 1);
+        }
+        for (uint8_t i = 0; i < s->dlc && i < sizeof(s->data); i++) {
+            s->data[i] = (uint8_t)rng_next(gen);
+        }
+    }
+}
+
+static void add_sender(can_loadgen_t *gen, uint32_t id, uint8_t dlc, uint32_t period_us, uint64_t phase_us) {
+    can_loadgen_sender_t *s = &gen->senders[gen->sender_count++];
+    memset(s, 0, sizeof(*s));
+    s->id = id;
+    s->dlc = dlc > 8 ? 8 : dlc;
+    s->period_us = period_us;
+    s->slot_us = phase_us;
+}
+
+/**
+ * Set up the shifter and the background streams for a target load
+ * Returns false for a bad configuration (load above 100%, too many streams, bad ID).
+ * The shifter's own traffic is always sent, even if it alone exceeds the target.
+ */
+bool can_loadgen_init(can_loadgen_t *gen, const can_loadgen_config_t *config) {
+    const can_loadgen_stream_t *streams = config->streams ? config->streams : can_loadgen_default_mix;
+    size_t stream_count = config->streams ? config->stream_count : can_loadgen_default_mix_count;
+    if (config->load_percent > 100 || stream_count > CAN_LOADGEN_MAX_STREAMS) {
+        return false;
+    }
+
+    memset(gen, 0, sizeof(*gen));
+    gen->bitrate = config->bitrate ? config->bitrate : CAN_LOADGEN_BITRATE;
+    gen->rng = config->seed ? config->seed : 1;
+    gen->lever_pos = lever_script[0].lever_pos;
+    gen->park_button = lever_script[0].park_button;
+    gen->script_next_us = lever_script[0].hold_ms * 1000ull;
+
+    static const uint8_t heartbeat[8] = {0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x5E};
+    add_sender(gen, CAN_ID_GEAR_LEVER_POSITION, 4, TIMING_GEAR_LEVER_RX_MS * 1000u, 0);
+    add_sender(gen, CAN_ID_GEAR_LEVER_HEARTBEAT, 8, SHIFTER_HEARTBEAT_PERIOD_US, 0);
+    memcpy(gen->senders[1].data, heartbeat, sizeof(heartbeat));
+    double shifter_load = 0.0;
+    for (size_t i = 0; i < gen->sender_count; i++) {
+        shifter_load += (double)frame_time_us(gen, gen->senders[i].dlc) / gen->senders[i].period_us;
+    }
+
+    // Scale all background periods by the same factor to fill the rest of the bus
+    double background_load = 0.0;
+    for (size_t i = 0; i < stream_count; i++) {
+        if (streams[i].id > 0x7FF || streams[i].period_us == 0 || streams[i].id == CAN_ID_GEAR_LEVER_POSITION ||
+            streams[i].id == CAN_ID_GEAR_LEVER_HEARTBEAT) {
+            return false;
+        }
+        background_load += (double)frame_time_us(gen, streams[i].dlc) / streams[i].period_us;
+    }
+    double wanted = config->load_percent / 100.0 - shifter_load;
+    for (size_t i = 0; i < stream_count && wanted > 0.0; i++) {
+        uint32_t min_period = frame_time_us(gen, streams[i].dlc);
+        double period = streams[i].period_us * background_load / wanted;
+        uint32_t period_us = period < min_period ? min_period : (uint32_t)period;
+        add_sender(gen, streams[i].id, streams[i].dlc, period_us, rng_next(gen) % period_us);
+    }
+    // Jitter stays below half a period, or a sender would overwrite its own frames
+    gen->jitter_us = config->jitter_us;
+    for (size_t i = 2; i < gen->sender_count; i++) {
+        if (gen->jitter_us > gen->senders[i].period_us / 2) {
+            gen->jitter_us = gen->senders[i].period_us / 2;
+        }
+    }
+
+    for (size_t i = 0; i < gen->sender_count; i++) {
+        sender_queue(gen, &gen->senders[i]);
+    }
+    return true;
+}
+
+/**
+ * Produce the next frame on the wire
+ */
+void can_loadgen_next(can_loadgen_t *gen, can_loadgen_event_t *event) {
+    while (1) {
+        uint64_t now = gen->bus_free_us;
+        can_loadgen_sender_t *winner = NULL;
+        uint64_t next_queued = UINT64_MAX;
+
+        for (size_t i = 0; i < gen->sender_count; i++) {
+            can_loadgen_sender_t *s = &gen->senders[i];
+            // A newer frame replaced the one still waiting for the bus
+            while (s->slot_us + s->period_us <= now) {
+                if (s->id == CAN_ID_GEAR_LEVER_POSITION) {
+                    gen->stats.lever_overwritten++;
+                } else {
+                    gen->stats.other_overwritten++;
+                }
+                s->slot_us += s->period_us;
+                sender_queue(gen, s);
+            }
+            if (s->queued_us <= now) {
+                if (winner == NULL || s->id < winner->id) {
+                    winner = s;
+                }
+            } else if (s->queued_us < next_queued) {
+                next_queued = s->queued_us;
+            }
+        }
+        if (winner == NULL) {
+            gen->bus_free_us = next_queued;  // Idle bus until the next sender is ready
+            continue;
+        }
+
+        uint32_t duration = frame_time_us(gen, winner->dlc);
+        memset(event, 0, sizeof(*event));
+        event->frame.id = winner->id;
+        event->frame.dlc = winner->dlc;
+        memcpy(event->frame.data, winner->data, winner->dlc);
+        event->frame.timestamp_us = now + duration;
+        event->queued_us = winner->queued_us;
+        event->lever = winner->id == CAN_ID_GEAR_LEVER_POSITION;
+        if (event->lever) {
+            gen->stats.lever_sent++;
+        } else {
+            gen->stats.other_sent++;
+        }
+        gen->stats.busy_us += duration;
+        gen->bus_free_us = now + duration;
+
+        winner->slot_us += winner->period_us;
+        sender_queue(gen, winner);
+        return;
+    }
+}
+
+/**
+ * Offered load of all senders in permille of the bus capacity
+ */
+uint32_t can_loadgen_offered_permille(const can_loadgen_t *gen) {
+    double load = 0.0;
+    for (size_t i = 0; i < gen->sender_count; i++) {
+        load += (double)frame_time_us(gen, gen->senders[i].dlc) / gen->senders[i].period_us;
+    }
+    return (uint32_t)(load * 1000.0 + 0.5);
+}
+
+void can_loadgen_get_stats(const can_loadgen_t *gen, can_loadgen_stats_t *stats) {
+    *stats = gen->stats;
+}
@@ -0,0 +1,92 @@
+#ifndef CAN_LOADGEN_H
+#define CAN_LOADGEN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "can_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Synthetic PT-CAN traffic on a simulated wire
+// A genuine shifter (0x197 every TIMING_GEAR_LEVER_RX_MS with CRC and counter,
+// driven by a looping lever script, plus the 0x55E heartbeat) shares the bus with
+// background streams whose periods are scaled to reach the requested total load.
+// Frames come out in wire order: among the frames queued when the bus goes idle the
+// lowest ID wins arbitration, and each frame occupies its worst-case stuffed length.
+// Like a CAN mailbox, a sender holds one frame per ID: when the next period comes
+// before the old frame got the bus, the old one is overwritten (lost on the wire).
+#define CAN_LOADGEN_BITRATE            500000u
+#define CAN_LOADGEN_MAX_STREAMS        16    // Background streams
+
+typedef struct {
+    uint32_t id;                 // Standard 11-bit ID
+    uint8_t dlc;
+    uint32_t period_us;          // Base period, scaled to reach the target load
+} can_loadgen_stream_t;
+
+typedef struct {
+    uint32_t bitrate;            // 0 = CAN_LOADGEN_BITRATE
+    uint8_t load_percent;        // Target load of all traffic (0-100), shifter included
+    const can_loadgen_stream_t *streams;  // Background mix, NULL = can_loadgen_default_mix
+    size_t stream_count;
+    uint32_t jitter_us;          // Background frames are queued up to this much late
+    uint32_t seed;               // Phases and jitter, same seed = same traffic
+} can_loadgen_config_t;
+
+// One frame on the wire
+typedef struct {
+    can_frame_t frame;           // timestamp_us = end of frame (when a receiver has it)
+    uint64_t queued_us;          // When the sender queued it
+    bool lever;                  // Genuine 0x197 from the lever script
+} can_loadgen_event_t;
+
+typedef struct {
+    uint32_t lever_sent;         // 0x197 frames that made it onto the wire
+    uint32_t lever_overwritten;  // 0x197 frames replaced before winning arbitration
+    uint32_t other_sent;
+    uint32_t other_overwritten;
+    uint64_t busy_us;            // Wire time used by all frames
+} can_loadgen_stats_t;
+
+// Sender of one ID (internal)
+typedef struct {
+    uint32_t id;
+    uint8_t dlc;
+    uint32_t period_us;          // 0 = disabled
+    uint64_t slot_us;            // Nominal time of the pending frame
+    uint64_t queued_us;          // slot_us plus jitter
+    uint8_t data[8];
+} can_loadgen_sender_t;
+
+typedef struct {
+    uint32_t bitrate;
+    uint32_t jitter_us;
+    uint32_t rng;
+    uint64_t bus_free_us;        // Wire idle from here on
+    size_t script_step;
+    uint64_t script_next_us;     // Time of the next lever script step
+    uint8_t lever_pos;
+    uint8_t park_button;
+    can_loadgen_sender_t senders[CAN_LOADGEN_MAX_STREAMS + 2];  // Shifter 0x197, 0x55E, background
+    size_t sender_count;
+    can_loadgen_stats_t stats;
+} can_loadgen_t;
+
+extern const can_loadgen_stream_t can_loadgen_default_mix[];
+extern const size_t can_loadgen_default_mix_count;
+
+// Function declarations
+bool can_loadgen_init(can_loadgen_t *gen, const can_loadgen_config_t *config);
+void can_loadgen_next(can_loadgen_t *gen, can_loadgen_event_t *event);
+uint32_t can_loadgen_frame_bits(uint8_t dlc, bool extended);
+uint32_t can_loadgen_offered_permille(const can_loadgen_t *gen);
+void can_loadgen_get_stats(const can_loadgen_t *gen, can_loadgen_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CAN_LOADGEN_H
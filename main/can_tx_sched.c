@@ -0,0 +1,212 @@
+#include "can_tx_sched.h"
+#include <string.h>
+
+#define INFLIGHT_EVENT  0x80
+
+void can_tx_sched_init(can_tx_sched_t *sched) {
+    memset(sched, 0, sizeof(*sched));
+    atomic_init(&sched->event_mask, 0);
+}
+
+// Move the slot at order[pos] to its place after its deadline changed
+static void reorder(can_tx_sched_t *sched, size_t pos) {
+    uint8_t slot = sched->order[pos];
+    uint64_t due = sched->slots[slot].next_due_us;
+
+    while (pos > 0 && sched->slots[sched->order[pos - 1]].next_due_us > due) {
+        sched->order[pos] = sched->order[pos - 1];
+        pos--;
+    }
+    while (pos + 1 < sched->count && sched->slots[sched->order[pos + 1]].next_due_us <= due) {
+        sched->order[pos] = sched->order[pos + 1];
+        pos++;
+    }
+    sched->order[pos] = slot;
+}
+
+static size_t order_position(const can_tx_sched_t *sched, uint8_t slot) {
+    for (size_t i = 0; i < sched->count; i++) {
+        if (sched->order[i] == slot) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Add a frame to the schedule (before the scheduler task starts)
+ *
+ * @param period_us Transmit interval, 0 for event-triggered only
+ * @return Slot index for can_tx_sched_trigger(), -1 if the table is full
+ */
+int can_tx_sched_add(can_tx_sched_t *sched, uint32_t id, uint32_t period_us,
+                     can_tx_build_fn_t build, void *ctx, uint64_t first_due_us) {
+    if (sched->count >= CAN_TX_SCHED_MAX_FRAMES || build == NULL) {
+        return -1;
+    }
+    uint8_t slot = (uint8_t)sched->count;
+    can_tx_slot_t *s = &sched->slots[slot];
+    memset(s, 0, sizeof(*s));
+    s->build = build;
+    s->ctx = ctx;
+    s->next_due_us = period_us ? first_due_us : UINT64_MAX;
+    s->stats.id = id;
+    s->stats.period_us = period_us;
+    s->stats.jitter_min_us = INT32_MAX;
+    s->stats.jitter_max_us = INT32_MIN;
+
+    sched->order[sched->count++] = slot;
+    reorder(sched, slot);
+    return slot;
+}
+
+/**
+ * Request an immediate send of a slot (any task); the periodic cycle restarts from it
+ */
+void can_tx_sched_trigger(can_tx_sched_t *sched, int slot) {
+    if (slot >= 0 && slot < CAN_TX_SCHED_MAX_FRAMES) {
+        atomic_fetch_or_explicit(&sched->event_mask, 1u << slot, memory_order_release);
+    }
+}
+
+// Build and submit one slot without blocking, returns false if the TX queue is full
+static bool submit(can_tx_sched_t *sched, uint8_t slot, bool event) {
+    can_tx_slot_t *s = &sched->slots[slot];
+    if (sched->inflight_count >= CAN_TX_SCHED_MAX_INFLIGHT) {
+        s->stats.queue_full++;
+        return false;
+    }
+
+    can_frame_t frame = {
+        .id = s->stats.id,
+    };
+    if (!s->build(&frame, s->ctx)) {
+        return true;  // Nothing to send this time
+    }
+
+    can_hal_status_t ret = can_hal_transmit(&frame, 0);
+    if (ret == CAN_HAL_ERR_TIMEOUT) {
+        s->stats.queue_full++;
+        return false;
+    }
+    if (ret != CAN_HAL_OK) {
+        s->stats.failed++;
+        return true;
+    }
+
+    size_t tail = (sched->inflight_head + sched->inflight_count) % CAN_TX_SCHED_MAX_INFLIGHT;
+    sched->inflight[tail] = slot | (event ? INFLIGHT_EVENT : 0);
+    sched->inflight_count++;
+    if (event) {
+        s->stats.events++;
+    }
+    return true;
+}
+
+/**
+ * Submit every frame that is due or triggered
+ *
+ * @return Microseconds until the next deadline (CAN_TX_SCHED_NO_DEADLINE if none)
+ */
+uint32_t can_tx_sched_run(can_tx_sched_t *sched, uint64_t now_us) {
+    // Event triggers first, each restarts its slot's period
+    uint32_t events = atomic_exchange_explicit(&sched->event_mask, 0, memory_order_acquire);
+    while (events != 0) {
+        uint8_t slot = (uint8_t)__builtin_ctz(events);
+        events &= events - 1;
+        if (slot >= sched->count) {
+            continue;
+        }
+        can_tx_slot_t *s = &sched->slots[slot];
+        if (submit(sched, slot, true)) {
+            if (s->stats.period_us) {
+                s->next_due_us = now_us + s->stats.period_us;
+                reorder(sched, order_position(sched, slot));
+            }
+        } else {
+            can_tx_sched_trigger(sched, slot);  // Try again on the next run
+        }
+    }
+
+    // Periodic frames in deadline order
+    while (sched->count > 0) {
+        uint8_t slot = sched->order[0];
+        can_tx_slot_t *s = &sched->slots[slot];
+        if (s->next_due_us > now_us) {
+            break;
+        }
+        if (submit(sched, slot, false)) {
+            // Keep the cadence; skip whole periods if we fell far behind
+            s->next_due_us += s->stats.period_us;
+            if (s->next_due_us <= now_us) {
+                s->next_due_us = now_us + s->stats.period_us;
+            }
+        } else {
+            s->next_due_us = now_us + CAN_TX_SCHED_RETRY_US;
+        }
+        reorder(sched, 0);
+    }
+
+    if (atomic_load_explicit(&sched->event_mask, memory_order_relaxed) != 0) {
+        return CAN_TX_SCHED_RETRY_US;
+    }
+    if (sched->count == 0 || sched->slots[sched->order[0]].next_due_us == UINT64_MAX) {
+        return CAN_TX_SCHED_NO_DEADLINE;
+    }
+    uint64_t wait = sched->slots[sched->order[0]].next_due_us - now_us;
+    return wait > UINT32_MAX - 1 ? UINT32_MAX - 1 : (uint32_t)wait;
+}
+
+/**
+ * Account for frames that left the controller (in submission order)
+ * The controller does not say which frame failed, failures are attributed to the oldest in flight.
+ */
+void can_tx_sched_complete(can_tx_sched_t *sched, uint32_t done, uint32_t failed, uint64_t now_us) {
+    while ((done > 0 || failed > 0) && sched->inflight_count > 0) {
+        uint8_t entry = sched->inflight[sched->inflight_head];
+        sched->inflight_head = (sched->inflight_head + 1) % CAN_TX_SCHED_MAX_INFLIGHT;
+        sched->inflight_count--;
+
+        can_tx_slot_t *s = &sched->slots[entry & ~INFLIGHT_EVENT];
+        bool event = (entry & INFLIGHT_EVENT) != 0;
+        if (failed > 0) {
+            failed--;
+            s->stats.failed++;
+            continue;
+        }
+        done--;
+        s->stats.sent++;
+
+        // Jitter only between two periodic sends, event sends restart the cycle
+        if (!event && !s->last_was_event && s->last_done_us != 0 && s->stats.period_us) {
+            int64_t jitter = (int64_t)(now_us - s->last_done_us) - (int64_t)s->stats.period_us;
+            int32_t j = jitter > INT32_MAX ? INT32_MAX : (jitter < INT32_MIN ? INT32_MIN : (int32_t)jitter);
+            if (j < s->stats.jitter_min_us) {
+                s->stats.jitter_min_us = j;
+            }
+            if (j > s->stats.jitter_max_us) {
+                s->stats.jitter_max_us = j;
+            }
+            s->stats.jitter_abs_sum_us += (uint64_t)(j < 0 ? -(int64_t)j : j);
+            s->stats.jitter_samples++;
+        }
+        s->last_done_us = now_us;
+        s->last_was_event = event;
+    }
+}
+
+size_t can_tx_sched_inflight(const can_tx_sched_t *sched) {
+    return sched->inflight_count;
+}
+
+size_t can_tx_sched_count(const can_tx_sched_t *sched) {
+    return sched->count;
+}
+
+bool can_tx_sched_get_stats(const can_tx_sched_t *sched, int slot, can_tx_stats_t *stats) {
+    if (slot < 0 || (size_t)slot >= sched->count || stats == NULL) {
+        return false;
+    }
+    *stats = sched->slots[slot].stats;
+    return true;
+}
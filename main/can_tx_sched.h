@@ -0,0 +1,76 @@
+#ifndef CAN_TX_SCHED_H
+#define CAN_TX_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "can_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Deadline-ordered CAN TX scheduler
+// One task owns the scheduler: it calls can_tx_sched_run() to submit due frames
+// without blocking and can_tx_sched_complete() with the completions reported by
+// can_hal_tx_wait(). can_tx_sched_trigger() may be called from any task; the statistics
+// are updated by the owner and must be read from it too (can_tx_sched_get_stats()).
+#define CAN_TX_SCHED_MAX_FRAMES        8
+#define CAN_TX_SCHED_MAX_INFLIGHT      16
+#define CAN_TX_SCHED_RETRY_US          1000  // Retry delay when the TX queue is full
+#define CAN_TX_SCHED_NO_DEADLINE       UINT32_MAX
+
+// Fill in the frame to send (id is preset); return false to skip this slot
+typedef bool (*can_tx_build_fn_t)(can_frame_t *frame, void *ctx);
+
+// Per-ID transmit statistics
+// Jitter is the interval between two periodic completions minus the period.
+typedef struct {
+    uint32_t id;
+    uint32_t period_us;
+    uint32_t sent;               // Completed on the bus
+    uint32_t failed;             // Reported failed by the controller
+    uint32_t queue_full;         // Submits retried because the TX queue was full
+    uint32_t events;             // Event-triggered sends
+    uint32_t jitter_samples;
+    int32_t jitter_min_us;
+    int32_t jitter_max_us;
+    uint64_t jitter_abs_sum_us;
+} can_tx_stats_t;
+
+typedef struct {
+    can_tx_build_fn_t build;
+    void *ctx;
+    uint64_t next_due_us;
+    uint64_t last_done_us;       // Completion time of the previous frame (0 = none yet)
+    bool last_was_event;
+    can_tx_stats_t stats;
+} can_tx_slot_t;
+
+typedef struct {
+    can_tx_slot_t slots[CAN_TX_SCHED_MAX_FRAMES];
+    uint8_t order[CAN_TX_SCHED_MAX_FRAMES];      // Slot indices sorted by next_due_us
+    size_t count;
+    uint8_t inflight[CAN_TX_SCHED_MAX_INFLIGHT]; // Submitted slots in bus order (bit 7 = event)
+    size_t inflight_head;
+    size_t inflight_count;
+    atomic_uint_least32_t event_mask;            // Slots with a pending trigger
+} can_tx_sched_t;
+
+// Function declarations
+void can_tx_sched_init(can_tx_sched_t *sched);
+int can_tx_sched_add(can_tx_sched_t *sched, uint32_t id, uint32_t period_us,
+                     can_tx_build_fn_t build, void *ctx, uint64_t first_due_us);
+void can_tx_sched_trigger(can_tx_sched_t *sched, int slot);
+uint32_t can_tx_sched_run(can_tx_sched_t *sched, uint64_t now_us);
+void can_tx_sched_complete(can_tx_sched_t *sched, uint32_t done, uint32_t failed, uint64_t now_us);
+size_t can_tx_sched_inflight(const can_tx_sched_t *sched);
+size_t can_tx_sched_count(const can_tx_sched_t *sched);
+bool can_tx_sched_get_stats(const can_tx_sched_t *sched, int slot, can_tx_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CAN_TX_SCHED_H
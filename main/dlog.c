@@ -0,0 +1,119 @@
+#include "dlog.h"
+#include <stdio.h>
+#include <string.h>
+
+#define DLOG_RING_MASK  (DLOG_RING_SLOTS - 1)
+
+// Bounded ring with a sequence number per slot: a producer claims a position with a
+// CAS on head and publishes the slot by advancing its sequence, the consumer frees it
+// by moving the sequence one lap ahead. No producer ever waits for another.
+typedef struct {
+    atomic_uint_least32_t seq;
+    dlog_record_t record;
+} dlog_slot_t;
+
+static dlog_slot_t ring[DLOG_RING_SLOTS];
+static atomic_uint_least32_t ring_head;   // Next position to claim (producers)
+static uint32_t ring_tail;                // Next position to read (consumer only)
+static atomic_uint_least32_t dropped;
+static dlog_clock_fn_t dlog_clock = NULL;
+
+#define DLOG_SITE_ENTRY(name, module, level, tag, format) \
+    {#name, tag, format, DLOG_LEVEL_##level},
+
+static const dlog_site_t sites[DLOG_SITE_COUNT] = {
+    DLOG_SITES(DLOG_SITE_ENTRY)
+};
+
+/**
+ * Reset the ring (before any producer runs)
+ *
+ * @param clock Timestamp source in microseconds, NULL for zero timestamps
+ */
+void dlog_init(dlog_clock_fn_t clock) {
+    for (uint32_t i = 0; i < DLOG_RING_SLOTS; i++) {
+        atomic_init(&ring[i].seq, i);
+    }
+    atomic_init(&ring_head, 0);
+    atomic_init(&dropped, 0);
+    ring_tail = 0;
+    dlog_clock = clock;
+}
+
+/**
+ * Queue one record (any task or ISR)
+ *
+ * @return false if the ring was full and the record was dropped
+ */
+bool dlog_write(dlog_site_id_t site, const uint32_t args[DLOG_MAX_ARGS]) {
+    uint32_t pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    dlog_slot_t *slot;
+
+    for (;;) {
+        slot = &ring[pos & DLOG_RING_MASK];
+        uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring_head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+            // pos was reloaded by the failed CAS
+        } else if (diff < 0) {
+            // Slot still holds a record from the previous lap
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+        }
+    }
+
+    slot->record.timestamp_us = dlog_clock ? (uint32_t)dlog_clock() : 0;
+    slot->record.site = (uint16_t)site;
+    memcpy(slot->record.args, args, sizeof(slot->record.args));
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * Take the oldest record (single consumer)
+ *
+ * @return false if the ring is empty (or the oldest record is still being written)
+ */
+bool dlog_read(dlog_record_t *record) {
+    dlog_slot_t *slot = &ring[ring_tail & DLOG_RING_MASK];
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq != ring_tail + 1) {
+        return false;
+    }
+    *record = slot->record;
+    atomic_store_explicit(&slot->seq, ring_tail + DLOG_RING_SLOTS, memory_order_release);
+    ring_tail++;
+    return true;
+}
+
+const dlog_site_t *dlog_get_site(uint16_t site) {
+    return site < DLOG_SITE_COUNT ? &sites[site] : NULL;
+}
+
+/**
+ * Format the message of a record (without level, timestamp or tag)
+ *
+ * @return snprintf() result, -1 for an unknown site
+ */
+int dlog_format(const dlog_record_t *record, char *buf, size_t len) {
+    const dlog_site_t *site = dlog_get_site(record->site);
+    if (site == NULL) {
+        return -1;
+    }
+    return snprintf(buf, len, site->format,
+                    (unsigned long)record->args[0], (unsigned long)record->args[1],
+                    (unsigned long)record->args[2], (unsigned long)record->args[3]);
+}
+
+/**
+ * Records dropped because the ring was full (since dlog_init)
+ */
+uint32_t dlog_dropped(void) {
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
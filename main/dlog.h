@@ -0,0 +1,96 @@
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "dlog_sites.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Deferred binary log for the hot paths
+// DLOG(site, args...) copies the site ID, a timestamp and the raw arguments into
+// a lock-free multi-producer ring (any task or ISR, never blocks, drops when
+// full). One consumer drains the ring later and formats the records, so no
+// printf or UART write happens on the producer side.
+#define DLOG_MAX_ARGS                  4
+#define DLOG_RING_SLOTS                64    // Power of two
+
+// Levels, same values as esp_log_level_t
+#define DLOG_LEVEL_NONE                0
+#define DLOG_LEVEL_ERROR               1
+#define DLOG_LEVEL_WARN                2
+#define DLOG_LEVEL_INFO                3
+#define DLOG_LEVEL_DEBUG               4
+#define DLOG_LEVEL_VERBOSE             5
+
+// Compile-time level per module; sites above it compile to nothing.
+// The race build (DLOG_RACE_BUILD) keeps only warnings and errors.
+#ifndef DLOG_DEFAULT_LEVEL
+#ifdef DLOG_RACE_BUILD
+#define DLOG_DEFAULT_LEVEL             DLOG_LEVEL_WARN
+#else
+#define DLOG_DEFAULT_LEVEL             DLOG_LEVEL_INFO
+#endif
+#endif
+#ifndef DLOG_MODULE_LEVEL_CAN
+#define DLOG_MODULE_LEVEL_CAN          DLOG_DEFAULT_LEVEL  // can_rx_task
+#endif
+#ifndef DLOG_MODULE_LEVEL_HID
+#define DLOG_MODULE_LEVEL_HID          DLOG_DEFAULT_LEVEL  // hid_update_task
+#endif
+#ifndef DLOG_MODULE_LEVEL_USB
+#define DLOG_MODULE_LEVEL_USB          DLOG_DEFAULT_LEVEL  // usb_hid
+#endif
+
+#define DLOG_SITE_ID(name, module, level, tag, format)       DLOG_SITE_##name,
+#define DLOG_SITE_ENABLED(name, module, level, tag, format) \
+    DLOG_ENABLED_##name = (DLOG_MODULE_LEVEL_##module >= DLOG_LEVEL_##level),
+
+typedef enum {
+    DLOG_SITES(DLOG_SITE_ID)
+    DLOG_SITE_COUNT
+} dlog_site_id_t;
+
+enum {
+    DLOG_SITES(DLOG_SITE_ENABLED)
+};
+
+#define DLOG(name, ...) do { \
+        if (DLOG_ENABLED_##name) { \
+            const uint32_t dlog_args_[DLOG_MAX_ARGS] = {__VA_ARGS__}; \
+            dlog_write(DLOG_SITE_##name, dlog_args_); \
+        } \
+    } while (0)
+
+typedef struct {
+    const char *name;
+    const char *tag;
+    const char *format;
+    uint8_t level;
+} dlog_site_t;
+
+typedef struct {
+    uint32_t timestamp_us;           // Clock at the producer, truncated
+    uint16_t site;                   // dlog_site_id_t
+    uint32_t args[DLOG_MAX_ARGS];
+} dlog_record_t;
+
+typedef int64_t (*dlog_clock_fn_t)(void);
+
+// Function declarations
+void dlog_init(dlog_clock_fn_t clock);
+bool dlog_write(dlog_site_id_t site, const uint32_t args[DLOG_MAX_ARGS]);
+bool dlog_read(dlog_record_t *record);
+const dlog_site_t *dlog_get_site(uint16_t site);
+int dlog_format(const dlog_record_t *record, char *buf, size_t len);
+uint32_t dlog_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DLOG_H
@@ -0,0 +1,23 @@
+#ifndef DLOG_SITES_H
+#define DLOG_SITES_H
+
+// Deferred log sites
+// X(name, module, level, tag, format)
+// The producer stores only the site ID and up to DLOG_MAX_ARGS 32-bit arguments;
+// the format is applied later with every argument passed as unsigned long, so
+// use %lu/%lX conversions only (no %s, no signed or 64-bit values). Append new sites
+// at the end: the IDs are what a host-side decoder sees.
+#define DLOG_SITES(X) \
+    X(GEAR_LEVER,         CAN, INFO, "BMW_SHIFTER", "Gear lever: pos=0x%02lX park=%lu gear=%lu") \
+    X(HID_GEAR_P,         HID, INFO, "BMW_SHIFTER", "HID: Gear indication P (0x20) - no buttons") \
+    X(HID_GEAR_R,         HID, INFO, "BMW_SHIFTER", "HID: Gear indication R (0x40) - button 2 pressed and held") \
+    X(HID_GEAR_N,         HID, INFO, "BMW_SHIFTER", "HID: Gear indication N (0x60) - button 1 pulsed") \
+    X(HID_GEAR_D,         HID, INFO, "BMW_SHIFTER", "HID: Gear indication D (0x80) - button 3 pulsed") \
+    X(HID_GEAR_MS,        HID, INFO, "BMW_SHIFTER", "HID: Gear indication M/S (0x81) - no buttons") \
+    X(HID_GEAR_UNKNOWN,   HID, WARN, "BMW_SHIFTER", "HID: Unknown gear indication 0x%02lX") \
+    X(HID_SHIFT_UP,       HID, INFO, "BMW_SHIFTER", "HID: Lever up in M mode - button 30 pulsed for %lu us") \
+    X(HID_SHIFT_DOWN,     HID, INFO, "BMW_SHIFTER", "HID: Lever down in M mode - button 31 pulsed for %lu us") \
+    X(USB_BUTTON_PRESS,   USB, INFO, "USB_HID",     "HID: Button %lu pressed (bit %lu)") \
+    X(USB_BUTTON_RELEASE, USB, INFO, "USB_HID",     "HID: Button %lu released (bit %lu)")
+
+#endif // DLOG_SITES_H
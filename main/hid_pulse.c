@@ -0,0 +1,164 @@
+#include "hid_pulse.h"
+#include "usb_hid.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "app_clock.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "HID_PULSE";
+
+typedef struct {
+    hid_pulse_state_t state;
+    int64_t pressed_at_us;
+    int64_t release_at_us;
+    esp_timer_handle_t timer;
+} pulse_slot_t;
+
+static pulse_slot_t slots[HID_PULSE_BUTTON_COUNT];
+// Held across the state change and the HID update, so a release from the timer
+// task can never overwrite a newer press of the same bit
+static SemaphoreHandle_t pulse_lock = NULL;
+static bool initialized = false;
+
+// One-shot expiry (esp_timer task): release the bit unless the pulse was restarted meanwhile
+static void pulse_timer_callback(void *arg) {
+    uint8_t bit = (uint8_t)(uintptr_t)arg;
+
+    xSemaphoreTake(pulse_lock, portMAX_DELAY);
+    pulse_slot_t *slot = &slots[bit];
+    if (slot->state == HID_PULSE_PULSING && app_clock_now_us() >= slot->release_at_us) {
+        slot->state = HID_PULSE_IDLE;
+        slot->pressed_at_us = 0;
+        slot->release_at_us = 0;
+        usb_hid_set_button_bits(1UL << bit, false);
+    }
+    xSemaphoreGive(pulse_lock);
+}
+
+/**
+ * Create the per-button one-shot timers
+ */
+esp_err_t hid_pulse_init(void) {
+    if (initialized) {
+        return ESP_OK;
+    }
+    pulse_lock = xSemaphoreCreateMutex();
+    if (pulse_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (uint8_t bit = 0; bit < HID_PULSE_BUTTON_COUNT; bit++) {
+        esp_timer_create_args_t args = {
+            .callback = pulse_timer_callback,
+            .arg = (void *)(uintptr_t)bit,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "hid_pulse",
+        };
+        esp_err_t ret = esp_timer_create(&args, &slots[bit].timer);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create pulse timer %u: %s", bit, esp_err_to_name(ret));
+            return ret;
+        }
+    }
+    initialized = true;
+    return ESP_OK;
+}
+
+// Move a bit to a new state and update the HID report
+static esp_err_t set_state(uint8_t bit, hid_pulse_state_t state, uint32_t width_us) {
+    if (bit >= HID_PULSE_BUTTON_COUNT || !initialized) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pulse_slot_t *slot = &slots[bit];
+
+    xSemaphoreTake(pulse_lock, portMAX_DELAY);
+    esp_timer_stop(slot->timer);  // An expiry already running re-checks release_at_us
+    int64_t now = app_clock_now_us();
+    if (state == HID_PULSE_IDLE) {
+        slot->pressed_at_us = 0;
+    } else if (slot->state == HID_PULSE_IDLE) {
+        slot->pressed_at_us = now;
+    }
+    slot->state = state;
+    slot->release_at_us = state == HID_PULSE_PULSING ? now + width_us : 0;
+    if (state == HID_PULSE_PULSING) {
+        esp_timer_start_once(slot->timer, width_us);
+    }
+    esp_err_t ret = usb_hid_set_button_bits(1UL << bit, state != HID_PULSE_IDLE);
+    xSemaphoreGive(pulse_lock);
+    return ret;
+}
+
+/**
+ * Press and hold a button bit until hid_pulse_release()
+ */
+esp_err_t hid_pulse_press(uint8_t bit) {
+    return set_state(bit, HID_PULSE_HELD, 0);
+}
+
+esp_err_t hid_pulse_release(uint8_t bit) {
+    return set_state(bit, HID_PULSE_IDLE, 0);
+}
+
+/**
+ * Press a button bit now and release it width_us later
+ * Restarting an active pulse extends it from now; a held button becomes a pulse.
+ */
+esp_err_t hid_pulse_start(uint8_t bit, uint32_t width_us) {
+    if (width_us == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return set_state(bit, HID_PULSE_PULSING, width_us);
+}
+
+/**
+ * Stop all pulses and release every bit in one HID report
+ */
+void hid_pulse_release_all(void) {
+    if (!initialized) {
+        usb_hid_release_all();
+        return;
+    }
+    xSemaphoreTake(pulse_lock, portMAX_DELAY);
+    for (uint8_t bit = 0; bit < HID_PULSE_BUTTON_COUNT; bit++) {
+        esp_timer_stop(slots[bit].timer);
+        slots[bit].state = HID_PULSE_IDLE;
+        slots[bit].pressed_at_us = 0;
+        slots[bit].release_at_us = 0;
+    }
+    usb_hid_release_all();
+    xSemaphoreGive(pulse_lock);
+}
+
+esp_err_t hid_pulse_get_info(uint8_t bit, hid_pulse_info_t *info) {
+    if (bit >= HID_PULSE_BUTTON_COUNT || info == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(pulse_lock, portMAX_DELAY);
+    info->state = slots[bit].state;
+    info->pressed_at_us = slots[bit].pressed_at_us;
+    info->release_at_us = slots[bit].release_at_us;
+    xSemaphoreGive(pulse_lock);
+    return ESP_OK;
+}
+
+/**
+ * Bit mask of all pressed (held or pulsing) button bits
+ */
+uint32_t hid_pulse_active_mask(void) {
+    uint32_t mask = 0;
+    if (!initialized) {
+        return 0;
+    }
+    xSemaphoreTake(pulse_lock, portMAX_DELAY);
+    for (uint8_t bit = 0; bit < HID_PULSE_BUTTON_COUNT; bit++) {
+        if (slots[bit].state != HID_PULSE_IDLE) {
+            mask |= 1UL << bit;
+        }
+    }
+    xSemaphoreGive(pulse_lock);
+    return mask;
+}
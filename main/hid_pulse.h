@@ -0,0 +1,43 @@
+#ifndef HID_PULSE_H
+#define HID_PULSE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per-button press/release engine for the 32 gamepad button bits
+// Each bit is either released, held until hid_pulse_release(), or pulsed: pressed
+// now and released by its own esp_timer one-shot. Bits are independent, so held
+// and pulsed buttons can be active at the same time.
+#define HID_PULSE_BUTTON_COUNT         32
+
+typedef enum {
+    HID_PULSE_IDLE = 0,      // Released
+    HID_PULSE_HELD,          // Pressed until hid_pulse_release()
+    HID_PULSE_PULSING        // Pressed, released automatically at release_at_us
+} hid_pulse_state_t;
+
+typedef struct {
+    hid_pulse_state_t state;
+    int64_t pressed_at_us;   // app_clock time of the press (0 if idle)
+    int64_t release_at_us;   // Scheduled release (HID_PULSE_PULSING only)
+} hid_pulse_info_t;
+
+// Function declarations
+esp_err_t hid_pulse_init(void);
+esp_err_t hid_pulse_press(uint8_t bit);
+esp_err_t hid_pulse_release(uint8_t bit);
+esp_err_t hid_pulse_start(uint8_t bit, uint32_t width_us);
+void hid_pulse_release_all(void);
+esp_err_t hid_pulse_get_info(uint8_t bit, hid_pulse_info_t *info);
+uint32_t hid_pulse_active_mask(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HID_PULSE_H
@@ -0,0 +1,77 @@
+#include "latency_probe.h"
+#include <string.h>
+
+// Bucket of a sample: [0,4) one per value, then 4 equal buckets per power of two
+static uint32_t bucket_index(uint32_t us) {
+    if (us < LATENCY_PROBE_SUB_BUCKETS) {
+        return us;
+    }
+    uint32_t exp = 31u - (uint32_t)__builtin_clz(us);  // >= 2
+    uint32_t sub = (us >> (exp - 2)) & (LATENCY_PROBE_SUB_BUCKETS - 1);
+    uint32_t index = (exp - 1) * LATENCY_PROBE_SUB_BUCKETS + sub;
+    return index < LATENCY_PROBE_BUCKETS ? index : LATENCY_PROBE_BUCKETS - 1;
+}
+
+// Largest value that falls into a bucket
+static uint32_t bucket_upper_us(uint32_t index) {
+    if (index < LATENCY_PROBE_SUB_BUCKETS) {
+        return index;
+    }
+    uint32_t exp = index / LATENCY_PROBE_SUB_BUCKETS + 1;
+    uint32_t sub = index % LATENCY_PROBE_SUB_BUCKETS;
+    return ((LATENCY_PROBE_SUB_BUCKETS + sub + 1) << (exp - 2)) - 1;
+}
+
+void latency_probe_reset(latency_probe_t *probe) {
+    memset(probe, 0, sizeof(*probe));
+    probe->min_us = UINT32_MAX;
+}
+
+/**
+ * Add one sample, end before start (clock mixup) is ignored
+ */
+void latency_probe_record(latency_probe_t *probe, int64_t start_us, int64_t end_us) {
+    if (end_us < start_us) {
+        return;
+    }
+    int64_t delta = end_us - start_us;
+    uint32_t us = delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta;
+    if (us < probe->min_us) {
+        probe->min_us = us;
+    }
+    if (us > probe->max_us) {
+        probe->max_us = us;
+    }
+    probe->sum_us += us;
+    probe->count++;
+    probe->buckets[bucket_index(us)]++;
+}
+
+uint32_t latency_probe_avg_us(const latency_probe_t *probe) {
+    return probe->count ? (uint32_t)(probe->sum_us / probe->count) : 0;
+}
+
+/**
+ * Latency not exceeded by permille/1000 of the samples (upper edge of its bucket,
+ * never above the largest sample)
+ *
+ * @return 0 if there are no samples
+ */
+uint32_t latency_probe_percentile_us(const latency_probe_t *probe, uint32_t permille) {
+    if (probe->count == 0) {
+        return 0;
+    }
+    uint64_t rank = ((uint64_t)probe->count * permille + 999) / 1000;  // Samples at or below the result
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_PROBE_BUCKETS; i++) {
+        seen += probe->buckets[i];
+        if (seen >= rank && i < LATENCY_PROBE_BUCKETS - 1) {
+            uint32_t upper = bucket_upper_us(i);
+            return upper < probe->max_us ? upper : probe->max_us;
+        }
+    }
+    return probe->max_us;
+}
@@ -0,0 +1,41 @@
+#ifndef LATENCY_PROBE_H
+#define LATENCY_PROBE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Latency accumulator for one path: min/avg/max plus a log-bucket histogram
+// Buckets are 4 per power of two (values below 4 us get one bucket each), so a
+// percentile is exact to within 25% up to LATENCY_PROBE_MAX_US; longer samples
+// land in the last bucket.
+// Not thread-safe: each probe has one recording task, readers copy it under the
+// owner's lock (or accept a slightly stale copy for logging).
+#define LATENCY_PROBE_SUB_BUCKETS      4
+#define LATENCY_PROBE_BUCKETS          96
+#define LATENCY_PROBE_MAX_US           ((1UL << 25) - 1)  // ~33.5 s
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[LATENCY_PROBE_BUCKETS];
+} latency_probe_t;
+
+#define LATENCY_PROBE_INITIALIZER      {.min_us = UINT32_MAX}
+
+// Function declarations
+void latency_probe_reset(latency_probe_t *probe);
+void latency_probe_record(latency_probe_t *probe, int64_t start_us, int64_t end_us);
+uint32_t latency_probe_avg_us(const latency_probe_t *probe);
+uint32_t latency_probe_percentile_us(const latency_probe_t *probe, uint32_t permille);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LATENCY_PROBE_H
@@ -1,157 +1,367 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/timers.h"
+#include "freertos/queue.h"
 #include "esp_log.h"
-#include "driver/twai.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
 #include "driver/uart.h"
+#include "can_hal.h"
+#include "can_tx_sched.h"
+#include "ring_buffer.h"
 #include "bmw_shifter.h"
 #include "serial_protocol.h"
 #include "usb_hid.h"
+#include "usb_cdc.h"
+#include "hid_pulse.h"
+#include "shift_queue.h"
+#include "latency_probe.h"
+#include "dlog.h"
+#include "app_clock.h"
+#include "shifter_link.h"
 
 static const char *TAG = "BMW_SHIFTER";
 
+// CAN RX filtering: only the IDs below reach the CPU (TWAI dual filter)
+// Set CAN_SNIFFER_MODE to 1 to accept every ID on the bus, e.g. to log the whole PT-CAN
+#define CAN_SNIFFER_MODE  0
+static const uint32_t can_rx_ids[] = {CAN_ID_GEAR_LEVER_POSITION, CAN_ID_GEAR_LEVER_HEARTBEAT};
+static volatile bool can_stats_requested = false;  // Set by serial_rx_task, served by can_rx_task
+static volatile bool latency_requested = false;    // get_latency, also served by can_rx_task
+static volatile bool latency_reset_requested = false;
+
 // Global state
+// shifter_state and prev_shifter_state belong to can_rx_task; other tasks read shifter_snapshot
 static bmw_shifter_state_t shifter_state;
 static bmw_shifter_state_t prev_shifter_state;  // Previous state for change detection
+static bmw_state_snapshot_t shifter_snapshot;   // Published by can_rx_task after every 0x197 frame
 static uint8_t backlight_level = BACKLIGHT_DEFAULT;
-static bool shifter_connected = false;
 static bool shifter_state_initialized = false;  // Track if we've seen first state update
-static uint32_t last_heartbeat_time = 0;  // Last time we received message from shifter
-static uint8_t current_gear_indication = 0;  // Current gear indication value (0x20=P, 0x40=R, 0x60=N, 0x80=D, 0x81=M/S)
+static shifter_link_t shifter_link;  // Serial throttles and shifter loss (can_rx_task and app_main)
+static portMUX_TYPE shifter_link_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t lever_crc_errors = 0;  // 0x197 frames with a bad CRC (still processed)
+static uint32_t lever_counter_skips = 0;  // 0x197 rolling counter gaps (lost or repeated frames)
+
+// Shift events - posted by can_rx_task, consumed by hid_update_task as soon as they arrive
+typedef enum {
+    SHIFT_EVENT_STATE = 0,     // Lever position or gear changed
+    SHIFT_EVENT_DISCONNECT,    // Shifter stopped responding, release everything
+    SHIFT_EVENT_WAKE           // A queued M-mode shift is due (shift_wake_timer)
+} shift_event_type_t;
+
+typedef struct {
+    shift_event_type_t type;
+    uint8_t lever_position;    // Lever position at the time of the event
+    bmw_gear_t current_gear;   // Gear at the time of the event
+    uint8_t gear_indication;   // Gear indication value (0x20=P, 0x40=R, 0x60=N, 0x80=D, 0x81=M/S)
+    bmw_manual_shift_t manual_shift;  // Manual gear change made by this frame, if any
+    int64_t rx_time_us;        // When can_rx_task received the frame (esp_timer time)
+} shift_event_t;
+
+#define SHIFT_EVENT_QUEUE_LEN  16
+static QueueHandle_t shift_event_queue = NULL;
+
+// Events that did not fit in the queue are coalesced here (newest state wins) and
+// picked up after the queue is drained, so the last state always reaches the HID side.
+// Once the slot is in use later events go to the slot too, to keep them in order.
+static portMUX_TYPE shift_overflow_lock = portMUX_INITIALIZER_UNLOCKED;
+static shift_event_t shift_overflow_state;
+static bool shift_overflow_valid = false;       // shift_overflow_state holds a state event
+static bool shift_overflow_disconnect = false;  // A disconnect came before shift_overflow_state
+
+// HID side view of the shifter, only touched by hid_update_task
+static shift_event_t hid_state = {SHIFT_EVENT_STATE, LEVER_POS_CENTER_MIDDLE, GEAR_P, 0, BMW_MANUAL_NONE, 0};
+static bool hid_state_valid = false;   // Set by the first state event after (re)connect
+static bool hid_update_pending = false;  // State changed but USB was not configured yet
+
+// Latency stages, all measured from the esp_timer time a 0x197 frame was received.
+// CAN RX -> HID report submitted / delivered to the host is measured by usb_hid for
+// the presses tagged below; the other stages live here under latency_lock.
+typedef enum {
+    LATENCY_STAGE_STATE = 0,     // Shifter state updated and published (can_rx_task)
+    LATENCY_STAGE_HID_TASK,      // Shift event picked up by hid_update_task
+    LATENCY_STAGE_HID_SUBMIT,    // Report with the press handed to TinyUSB
+    LATENCY_STAGE_HID_COMPLETE,  // Report with the press read by the host
+    LATENCY_STAGE_DISPLAY_TX,    // 0x3FD with the new indication queued to the TWAI controller
+    LATENCY_STAGE_COUNT
+} latency_stage_t;
+
+static const char *const latency_stage_names[LATENCY_STAGE_COUNT] = {
+    "can_to_state", "can_to_hid_task", "can_to_hid_submit", "can_to_hid_complete", "can_to_display_tx",
+};
+
+static portMUX_TYPE latency_lock = portMUX_INITIALIZER_UNLOCKED;
+static latency_probe_t state_latency = LATENCY_PROBE_INITIALIZER;
+static latency_probe_t dispatch_latency = LATENCY_PROBE_INITIALIZER;
+static latency_probe_t display_latency = LATENCY_PROBE_INITIALIZER;
+static int64_t display_origin_us = 0;  // Frame behind a pending 0x3FD indication change
+
+static void record_latency(latency_probe_t *probe, int64_t origin_us) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&latency_lock);
+    latency_probe_record(probe, origin_us, now);
+    portEXIT_CRITICAL(&latency_lock);
+}
+
+// Copy one stage (and optionally restart it)
+static void get_latency(latency_stage_t stage, latency_probe_t *probe, bool reset) {
+    latency_probe_t *local = stage == LATENCY_STAGE_STATE ? &state_latency :
+                             stage == LATENCY_STAGE_HID_TASK ? &dispatch_latency :
+                             stage == LATENCY_STAGE_DISPLAY_TX ? &display_latency : NULL;
+    if (local == NULL) {
+        usb_hid_get_latency(stage == LATENCY_STAGE_HID_SUBMIT ? probe : NULL,
+                            stage == LATENCY_STAGE_HID_COMPLETE ? probe : NULL, false);
+        return;  // usb_hid restarts both of its stages at once, see send_latency_report()
+    }
+    portENTER_CRITICAL(&latency_lock);
+    *probe = *local;
+    if (reset) {
+        latency_probe_reset(local);
+    }
+    portEXIT_CRITICAL(&latency_lock);
+}
 
-// Button press timing - track when buttons were pressed for 80ms release
-static uint32_t button_press_time = 0;  // Time when button was pressed (0 = no button pressed, UINT32_MAX = hold button)
-static hid_button_t pressed_button = HID_BUTTON_P;  // Currently pressed button
-static bool button_is_pressed = false;  // Flag indicating if button is currently pressed
-static bool button_should_hold = false;  // Flag indicating if button should be held (for R button)
+// Gear and shift buttons are pulsed for HID_PULSE_POLLS host polls of the IN endpoint
+// (R is held while reverse is engaged). Until the poll period has been measured, or
+// with HID_PULSE_POLLS 0, the fixed widths below are used.
+#ifndef HID_PULSE_POLLS
+#define HID_PULSE_POLLS     2
+#endif
+#define HID_PULSE_WIDTH_US  (80 * 1000)
+
+// M-mode shifts are played back one pulse at a time, at least this long released in between
+// (or HID_PULSE_POLLS polls, like the pulse)
+#define SHIFT_GAP_US        (20 * 1000)
+// The playback slots are shorter than a tick, so an esp_timer one-shot wakes the task for them.
+#define SHIFT_RETRY_US      (10 * 1000)  // Recheck while USB is not configured
+static shift_queue_t shift_fifo;  // Only touched by hid_update_task
+static esp_timer_handle_t shift_wake_timer = NULL;
+// Read by app_main for the shift report, both under shift_overflow_lock
+static shift_queue_stats_t shift_stats_published;  // Copy of the shift_fifo stats, set by hid_update_task
+static uint32_t shift_posts_dropped = 0;           // Manual shifts lost to a full event queue
 
 // CAN message buffers
-static gear_display_msg_t gear_display_msg = {0, 0, 0, 0x0C, 0xFF};
+// 0x3FD frames are precomputed for every gear indication and counter value at boot
+static const gear_display_msg_t gear_display_template = {0, 0x00, GEAR_IND_P, 0x0C, 0xFF};
+static const uint8_t gear_display_variants[] = {GEAR_IND_P, GEAR_IND_R, GEAR_IND_N, 0x80, GEAR_IND_D};
+static uint8_t gear_display_frames[sizeof(gear_display_variants)][BMW_COUNTER_MODULO][sizeof(gear_display_msg_t)];
+static bmw_tx_cache_t gear_display_cache = {
+    .can_id = CAN_ID_DISPLAY_GEAR,
+    .template_data = (const uint8_t *)&gear_display_template,
+    .len = sizeof(gear_display_msg_t),
+    .variant_byte = offsetof(gear_display_msg_t, gear_indication),
+    .variants = gear_display_variants,
+    .variant_count = sizeof(gear_display_variants),
+    .frames = &gear_display_frames[0][0][0],
+};
 static backlight_msg_t backlight_msg = {BACKLIGHT_DEFAULT, 0x00};
 static heartbeat_msg_t heartbeat_msg = {{0, 0, 0, 0}, 0x02, {0, 0}, 0x5E};
 
-// Timer handles
-static TimerHandle_t timer_gear_display = NULL;
-static TimerHandle_t timer_backlight = NULL;
-static TimerHandle_t timer_heartbeat = NULL;
+// Serial TX ring - filled by can_rx_task (the only producer), drained by serial_tx_task
+#define SERIAL_TX_RING_SIZE  4096
+static uint8_t serial_tx_storage[SERIAL_TX_RING_SIZE];
+static ring_buffer_t serial_tx_ring;
+static TaskHandle_t serial_tx_task_handle = NULL;  // Woken by the producer after each write
+
+// CAN TX scheduler - can_tx_task owns all periodic and event-triggered frames
+static can_tx_sched_t tx_sched;
+static int tx_slot_gear_display = -1;
+static int tx_slot_backlight = -1;
+static TaskHandle_t can_tx_task_handle = NULL;
+// Statistics copied out by can_tx_task for the 10 s report (the live ones are only touched by it)
+#define TX_STATS_PUBLISH_US  (1000 * 1000)
+static can_tx_stats_t tx_stats_published[CAN_TX_SCHED_MAX_FRAMES];
+static size_t tx_stats_published_count = 0;
+static portMUX_TYPE tx_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Gear indication value shown on the shifter for the given state
+static uint8_t gear_indication_for_state(const bmw_shifter_state_t *state) {
+    uint8_t gear_ind = bmw_get_gear_indication(state->current_gear);
+    
+    // If in M mode and lever is moved to side, use 0x81 (M/S)
+    if (state->current_gear == GEAR_M && 
+        state->lever_position == LEVER_POS_CENTER_SIDE) {
+        gear_ind = 0x81;  // M/S mode
+    }
+    return gear_ind;
+}
+
+static uint8_t prev_gear_indication = 0;
+
+// Host poll period the pulses are sized from, 0 while unknown (fixed widths are used then)
+static uint32_t pulse_poll_us(void) {
+    return HID_PULSE_POLLS > 0 ? usb_hid_get_poll_period_us() : 0;
+}
+
+static uint32_t hid_pulse_width_us(uint32_t poll_us) {
+    return poll_us ? HID_PULSE_POLLS * poll_us : HID_PULSE_WIDTH_US;
+}
+
+// Pulse or hold a gamepad button (the bit mapping lives in usb_hid)
+// origin_us is the receive time of the CAN frame behind a press, for the latency probe
+static void pulse_button(hid_button_t button, int64_t origin_us) {
+    int bit = usb_hid_button_bit(button);
+    if (bit >= 0) {
+        usb_hid_set_latency_origin(origin_us);
+        hid_pulse_start((uint8_t)bit, hid_pulse_width_us(pulse_poll_us()));
+        usb_hid_set_latency_origin(0);
+    }
+}
+
+static void hold_button(hid_button_t button, bool pressed, int64_t origin_us) {
+    int bit = usb_hid_button_bit(button);
+    if (bit >= 0) {
+        if (pressed) {
+            usb_hid_set_latency_origin(origin_us);
+            hid_pulse_press((uint8_t)bit);
+            usb_hid_set_latency_origin(0);
+        } else {
+            hid_pulse_release((uint8_t)bit);
+        }
+    }
+}
 
 // Update HID buttons based on gear indication value
-// This function is called periodically from hid_update_task
-static void update_hid_buttons_from_gear_indication(void) {
+// Called from hid_update_task whenever a shift event arrives
+static bool update_hid_buttons_from_gear_indication(void) {
     if (!usb_hid_is_ready()) {
-        return;  // USB HID not ready, skip
+        return false;  // USB HID not ready, retry later
     }
     
-    static uint8_t prev_gear_indication = 0;
+    uint8_t current_gear_indication = hid_state.gear_indication;
     
     // Check if gear indication changed
     if (current_gear_indication == prev_gear_indication) {
-        // If R is active and button should be held, ensure it's still pressed
-        if (current_gear_indication == 0x40 && button_is_pressed && pressed_button == HID_BUTTON_R) {
-            // R is still active, keep button pressed (already pressed, no action needed)
-            return;
-        }
-        return;  // No change, don't press buttons again
+        return true;  // No change, don't press buttons again
     }
     
-    // If button is currently pressed, release it first (unless it's R and we're switching to R)
-    if (button_is_pressed && !(current_gear_indication == 0x40 && pressed_button == HID_BUTTON_R)) {
-        usb_hid_send_button(pressed_button, HID_ACTION_RELEASE);
-        button_is_pressed = false;
-        button_press_time = 0;
-        button_should_hold = false;
+    // R is held only while reverse is engaged; pulses of other buttons run to their own end
+    if (prev_gear_indication == 0x40) {
+        hold_button(HID_BUTTON_R, false, 0);
     }
     
     // Press button based on gear indication
     switch (current_gear_indication) {
         case 0x20:  // P - don't press any buttons
-            ESP_LOGI(TAG, "HID: Gear indication P (0x20) - no buttons");
+            DLOG(HID_GEAR_P);
             break;
             
         case 0x40:  // R - press button 2 and hold while 0x40 is active
-            usb_hid_send_button(HID_BUTTON_R, HID_ACTION_PRESS);
-            pressed_button = HID_BUTTON_R;
-            button_is_pressed = true;
-            button_press_time = UINT32_MAX;  // Special value to indicate hold
-            button_should_hold = true;
-            ESP_LOGI(TAG, "HID: Gear indication R (0x40) - button 2 pressed and held");
+            hold_button(HID_BUTTON_R, true, hid_state.rx_time_us);
+            DLOG(HID_GEAR_R);
             break;
             
-        case 0x60:  // N - press button 1 for 80ms
-            usb_hid_send_button(HID_BUTTON_N, HID_ACTION_PRESS);
-            pressed_button = HID_BUTTON_N;
-            button_is_pressed = true;
-            button_press_time = xTaskGetTickCount();
-            button_should_hold = false;
-            ESP_LOGI(TAG, "HID: Gear indication N (0x60) - button 1 pressed for 80ms");
+        case 0x60:  // N - pulse button 1
+            pulse_button(HID_BUTTON_N, hid_state.rx_time_us);
+            DLOG(HID_GEAR_N);
             break;
             
-        case 0x80:  // D - press button 3 for 80ms
-            usb_hid_send_button(HID_BUTTON_D, HID_ACTION_PRESS);
-            pressed_button = HID_BUTTON_D;
-            button_is_pressed = true;
-            button_press_time = xTaskGetTickCount();
-            button_should_hold = false;
-            ESP_LOGI(TAG, "HID: Gear indication D (0x80) - button 3 pressed for 80ms");
+        case 0x80:  // D - pulse button 3
+            pulse_button(HID_BUTTON_D, hid_state.rx_time_us);
+            DLOG(HID_GEAR_D);
             break;
             
         case 0x81:  // M/S (lever moved to side) - don't press any buttons
-            ESP_LOGI(TAG, "HID: Gear indication M/S (0x81) - no buttons");
+            DLOG(HID_GEAR_MS);
             break;
             
         default:
-            ESP_LOGW(TAG, "HID: Unknown gear indication 0x%02X", current_gear_indication);
+            DLOG(HID_GEAR_UNKNOWN, current_gear_indication);
             break;
     }
     
     prev_gear_indication = current_gear_indication;
+    return true;
 }
 
-// Update +/- buttons based on current lever position (called periodically)
-static void update_hid_plus_minus_buttons(void) {
+// Start the next queued M-mode shift once the previous one has been released long enough
+// Returns the time until the next shift is due (SHIFT_QUEUE_NO_DEADLINE if none is queued)
+static uint32_t play_manual_shifts(void) {
+    uint64_t now = (uint64_t)app_clock_now_us();
     if (!usb_hid_is_ready()) {
-        return;  // USB HID not ready, skip
+        // Keep the shifts until the host is back
+        return shift_fifo.count > 0 ? SHIFT_RETRY_US : SHIFT_QUEUE_NO_DEADLINE;
     }
     
-    static uint8_t last_lever_pos = 0;
-    static bool last_was_m_mode = false;
-    
-    // Check if we're in M mode
-    bool is_m_mode = (shifter_state.current_gear == GEAR_M);
+    // Spacing follows the pulse width, so shift throughput scales with the host poll rate
+    uint32_t poll_us = pulse_poll_us();
+    uint32_t width_us = hid_pulse_width_us(poll_us);
+    shift_queue_set_timing(&shift_fifo, width_us, poll_us ? width_us : SHIFT_GAP_US);
     
-    // If lever position changed or mode changed, update buttons
-    if (shifter_state.lever_position != last_lever_pos || is_m_mode != last_was_m_mode) {
-        // If button is currently pressed, release it first
-        if (button_is_pressed && (pressed_button == HID_BUTTON_PLUS || pressed_button == HID_BUTTON_MINUS)) {
-            usb_hid_send_button(pressed_button, HID_ACTION_RELEASE);
-            button_is_pressed = false;
-            button_press_time = 0;
+    shift_queue_item_t shift;
+    if (shift_queue_next(&shift_fifo, now, &shift)) {
+        if (shift.shift == BMW_MANUAL_DEC) {
+            // Lever side up in M mode - pulse + button (button 30)
+            pulse_button(HID_BUTTON_PLUS, shift.origin_us);
+            DLOG(HID_SHIFT_UP, width_us);
+        } else {
+            // Lever side down in M mode - pulse - button (button 31)
+            pulse_button(HID_BUTTON_MINUS, shift.origin_us);
+            DLOG(HID_SHIFT_DOWN, width_us);
         }
-        
-        // Press buttons based on current lever position in M mode (will be released after 80ms)
-        if (is_m_mode) {
-            if (shifter_state.lever_position == LEVER_POS_SIDE_UP) {
-                // Lever moved up in M mode - press + button (button 30) for 80ms
-                usb_hid_send_button(HID_BUTTON_PLUS, HID_ACTION_PRESS);
-                pressed_button = HID_BUTTON_PLUS;
-                button_is_pressed = true;
-                button_press_time = xTaskGetTickCount();
-                ESP_LOGI(TAG, "HID: Lever up in M mode - button 30 pressed for 80ms");
-            } else if (shifter_state.lever_position == LEVER_POS_SIDE_DOWN) {
-                // Lever moved down in M mode - press - button (button 31) for 80ms
-                usb_hid_send_button(HID_BUTTON_MINUS, HID_ACTION_PRESS);
-                pressed_button = HID_BUTTON_MINUS;
-                button_is_pressed = true;
-                button_press_time = xTaskGetTickCount();
-                ESP_LOGI(TAG, "HID: Lever down in M mode - button 31 pressed for 80ms");
+    }
+    return shift_queue_wait_us(&shift_fifo, now);
+}
+
+// Release every HID button and forget the HID view of the shifter
+static void release_all_hid_buttons(void) {
+    ESP_LOGI(TAG, "HID: Releasing all buttons due to connection loss");
+    hid_pulse_release_all();  // One report, queued even if USB is not ready yet
+    // Reset gear indication to trigger update on reconnect
+    prev_gear_indication = 0;
+    shift_queue_clear(&shift_fifo);
+    hid_state_valid = false;
+    hid_update_pending = false;
+}
+
+// Post a shift event to hid_update_task (never blocks the CAN RX path)
+static void post_shift_event(shift_event_type_t type, const bmw_shifter_state_t *state,
+                             bmw_manual_shift_t manual_shift, int64_t rx_time_us) {
+    shift_event_t event = {
+        .type = type,
+        .lever_position = state->lever_position,
+        .current_gear = state->current_gear,
+        .gear_indication = gear_indication_for_state(state),
+        .manual_shift = manual_shift,
+        .rx_time_us = rx_time_us,
+    };
+    portENTER_CRITICAL(&shift_overflow_lock);
+    bool in_use = shift_overflow_valid || shift_overflow_disconnect;
+    portEXIT_CRITICAL(&shift_overflow_lock);
+    if (!in_use && xQueueSend(shift_event_queue, &event, 0) == pdTRUE) {
+        return;
+    }
+
+    bool dropped_shift = false;
+    portENTER_CRITICAL(&shift_overflow_lock);
+    if (type == SHIFT_EVENT_DISCONNECT) {
+        dropped_shift = shift_overflow_valid && shift_overflow_state.manual_shift != BMW_MANUAL_NONE;
+        shift_overflow_valid = false;
+        shift_overflow_disconnect = true;
+    } else {
+        // Keep a pending manual shift unless this state brings a new one
+        if (shift_overflow_valid && shift_overflow_state.manual_shift != BMW_MANUAL_NONE) {
+            if (manual_shift == BMW_MANUAL_NONE) {
+                event.manual_shift = shift_overflow_state.manual_shift;
+                event.rx_time_us = shift_overflow_state.rx_time_us;
+            } else {
+                dropped_shift = true;
             }
-            // If lever is in center position, buttons are not pressed
         }
-        
-        last_lever_pos = shifter_state.lever_position;
-        last_was_m_mode = is_m_mode;
+        shift_overflow_state = event;
+        shift_overflow_valid = true;
+    }
+    if (dropped_shift) {
+        shift_posts_dropped++;  // Also reached from app_main via shifter_lost()
+    }
+    portEXIT_CRITICAL(&shift_overflow_lock);
+    if (!in_use) {
+        // The task may have drained the full queue meanwhile: make sure it looks at the slot
+        ESP_LOGW(TAG, "Shift event queue full, coalescing state");
+        shift_event_t wake = {.type = SHIFT_EVENT_WAKE};
+        xQueueSend(shift_event_queue, &wake, 0);
     }
 }
 
@@ -168,215 +378,512 @@ static void update_hid_buttons_from_shifter(void) {
     memcpy(&prev_shifter_state, &shifter_state, sizeof(bmw_shifter_state_t));
 }
 
-// HID update task - periodically updates HID buttons based on current state
+// Wake hid_update_task for the next queued shift (esp_timer task)
+static void shift_wake_callback(void *arg) {
+    shift_event_t event = {.type = SHIFT_EVENT_WAKE};
+    xQueueSend(shift_event_queue, &event, 0);  // A full queue wakes the task anyway
+}
+
+// Take over a state event as the HID side view
+static void apply_state_event(const shift_event_t *event) {
+    record_latency(&dispatch_latency, event->rx_time_us);
+    hid_state = *event;
+    hid_state_valid = true;
+    hid_update_pending = true;
+    shift_queue_push(&shift_fifo, event->manual_shift, event->rx_time_us);
+}
+
+// HID update task - sleeps until a shift event arrives or a queued M-mode shift is due
+// (button releases run on their own timers)
 void hid_update_task(void *pvParameters) {
-    const uint32_t BUTTON_PRESS_DURATION_MS = 80;  // Button press duration
-    
     while (1) {
-        if (usb_hid_is_ready() && shifter_state_initialized) {
-            // Check if button needs to be released (80ms after press, but not if it should be held)
-            if (button_is_pressed && button_press_time != 0 && button_press_time != UINT32_MAX && !button_should_hold) {
-                uint32_t now = xTaskGetTickCount();
-                if ((now - button_press_time) >= pdMS_TO_TICKS(BUTTON_PRESS_DURATION_MS)) {
-                    // Release button after 80ms (only if not R button)
-                    usb_hid_send_button(pressed_button, HID_ACTION_RELEASE);
-                    button_is_pressed = false;
-                    button_press_time = 0;
-                    button_should_hold = false;
-                    ESP_LOGI(TAG, "HID: Button released after 80ms");
-                }
+        // Sleep until the next event, or until shift_wake_timer fires for a due shift or a retry
+        TickType_t wait = portMAX_DELAY;
+        
+        shift_event_t event;
+        while (xQueueReceive(shift_event_queue, &event, wait) == pdTRUE) {
+            if (event.type == SHIFT_EVENT_DISCONNECT) {
+                release_all_hid_buttons();
+            } else if (event.type == SHIFT_EVENT_STATE) {
+                apply_state_event(&event);
             }
-            
-            // Update HID buttons based on gear indication and lever position
-            update_hid_buttons_from_gear_indication();
-            update_hid_plus_minus_buttons();
+            wait = 0;  // Drain whatever else is queued without sleeping
+        }
+        
+        // Newest events that overflowed the queue, after everything queued before them
+        portENTER_CRITICAL(&shift_overflow_lock);
+        bool overflow_disconnect = shift_overflow_disconnect;
+        bool overflow_valid = shift_overflow_valid;
+        event = shift_overflow_state;
+        shift_overflow_disconnect = false;
+        shift_overflow_valid = false;
+        portEXIT_CRITICAL(&shift_overflow_lock);
+        if (overflow_disconnect) {
+            release_all_hid_buttons();
+        }
+        if (overflow_valid) {
+            apply_state_event(&event);
+        }
+        
+        if (hid_update_pending && hid_state_valid) {
+            // Update HID buttons based on gear indication
+            hid_update_pending = !update_hid_buttons_from_gear_indication();
         }
-        vTaskDelay(pdMS_TO_TICKS(10));  // Update every 10ms for precise timing
+        
+        uint32_t shift_wait_us = play_manual_shifts();
+        shift_queue_stats_t shift_stats;
+        shift_queue_get_stats(&shift_fifo, &shift_stats);
+        portENTER_CRITICAL(&shift_overflow_lock);
+        shift_stats_published = shift_stats;
+        portEXIT_CRITICAL(&shift_overflow_lock);
+        if (hid_update_pending && shift_wait_us > SHIFT_RETRY_US) {
+            shift_wait_us = SHIFT_RETRY_US;  // USB not configured yet, try the update again
+        }
+        esp_timer_stop(shift_wake_timer);
+        if (shift_wait_us != SHIFT_QUEUE_NO_DEADLINE) {
+            esp_timer_start_once(shift_wake_timer, shift_wait_us ? shift_wait_us : 1);
+        }
+    }
+}
+
+// Wake can_tx_task to send a frame now (gear indication or backlight changed)
+static void trigger_can_tx(int slot) {
+    can_tx_sched_trigger(&tx_sched, slot);
+    if (can_tx_task_handle != NULL) {
+        xTaskNotifyGive(can_tx_task_handle);
     }
 }
 
-// Timer callbacks
-void timer_gear_display_callback(TimerHandle_t xTimer) {
+// TX frame builders (run in can_tx_task)
+static bool build_gear_display_frame(can_frame_t *msg, void *ctx) {
     // Get gear indication based on current gear and lever position
-    uint8_t gear_ind = bmw_get_gear_indication(shifter_state.current_gear);
+    bmw_shifter_state_t state;
+    bmw_state_snapshot_read(&shifter_snapshot, &state);
+    uint8_t gear_ind = gear_indication_for_state(&state);
     
-    // If in M mode and lever is moved to side, use 0x81 (M/S)
-    if (shifter_state.current_gear == GEAR_M && 
-        shifter_state.lever_position == LEVER_POS_CENTER_SIDE) {
-        gear_ind = 0x81;  // M/S mode
+    // Precomputed frame with CRC and counter for this indication
+    const uint8_t *frame = bmw_tx_cache_next(&gear_display_cache, gear_ind);
+    if (frame == NULL) {
+        ESP_LOGW(TAG, "No display frame for gear indication 0x%02X", gear_ind);
+        return false;
     }
     
-    gear_display_msg.gear_indication = gear_ind;
-    current_gear_indication = gear_ind;  // Store current indication for HID logic
-    
-    bmw_update_pkt(CAN_ID_DISPLAY_GEAR, (uint8_t*)&gear_display_msg, sizeof(gear_display_msg));
-    
-    twai_message_t msg;
-    msg.identifier = CAN_ID_DISPLAY_GEAR;
-    msg.flags = 0;
-    msg.data_length_code = sizeof(gear_display_msg);
-    memcpy(msg.data, &gear_display_msg, sizeof(gear_display_msg));
-    
-    esp_err_t ret = twai_transmit(&msg, pdMS_TO_TICKS(10));
-    if (ret != ESP_OK) {
-        ESP_LOGW(TAG, "Failed to send gear display: %s", esp_err_to_name(ret));
+    // First frame showing a new indication: the scheduler submits it right after this returns
+    portENTER_CRITICAL(&latency_lock);
+    int64_t origin_us = display_origin_us;
+    display_origin_us = 0;
+    portEXIT_CRITICAL(&latency_lock);
+    if (origin_us != 0) {
+        record_latency(&display_latency, origin_us);
     }
     
-    // Note: HID button updates are handled in can_rx_task to avoid stack overflow in timer callback
+    msg->dlc = sizeof(gear_display_msg_t);
+    memcpy(msg->data, frame, sizeof(gear_display_msg_t));
+    return true;
 }
 
-void timer_backlight_callback(TimerHandle_t xTimer) {
+static bool build_backlight_frame(can_frame_t *msg, void *ctx) {
     backlight_msg.backlight_level = backlight_level;
+    msg->dlc = sizeof(backlight_msg);
+    memcpy(msg->data, &backlight_msg, sizeof(backlight_msg));
+    return true;
+}
+
+static bool build_heartbeat_frame(can_frame_t *msg, void *ctx) {
+    msg->dlc = sizeof(heartbeat_msg);
+    memcpy(msg->data, &heartbeat_msg, sizeof(heartbeat_msg));
+    return true;
+}
+
+// Round a microsecond wait up to whole ticks
+static TickType_t us_to_ticks(uint32_t us) {
+    if (us == CAN_TX_SCHED_NO_DEADLINE) {
+        return portMAX_DELAY;
+    }
+    const uint32_t tick_us = portTICK_PERIOD_MS * 1000;
+    return (TickType_t)((us + tick_us - 1) / tick_us);
+}
+
+// Copy the scheduler statistics for app_main; 64-bit sums would tear if read while updated
+static void publish_tx_stats(void) {
+    can_tx_stats_t stats[CAN_TX_SCHED_MAX_FRAMES];
+    size_t count = can_tx_sched_count(&tx_sched);
+    for (size_t i = 0; i < count; i++) {
+        can_tx_sched_get_stats(&tx_sched, (int)i, &stats[i]);
+    }
+    portENTER_CRITICAL(&tx_stats_lock);
+    memcpy(tx_stats_published, stats, count * sizeof(stats[0]));
+    tx_stats_published_count = count;
+    portEXIT_CRITICAL(&tx_stats_lock);
+}
+
+// CAN TX task - submits due frames without blocking, then waits for completions,
+// the next deadline or a trigger, whichever comes first
+void can_tx_task(void *pvParameters) {
+    int64_t last_publish_us = 0;
     
-    twai_message_t msg;
-    msg.identifier = CAN_ID_BACKLIGHT;
-    msg.flags = 0;
-    msg.data_length_code = sizeof(backlight_msg);
-    memcpy(msg.data, &backlight_msg, sizeof(backlight_msg));
+    while (1) {
+        int64_t now_us = app_clock_now_us();
+        if (now_us - last_publish_us >= TX_STATS_PUBLISH_US) {
+            last_publish_us = now_us;
+            publish_tx_stats();
+        }
+        uint32_t wait_us = can_tx_sched_run(&tx_sched, (uint64_t)now_us);
+        
+        if (can_tx_sched_inflight(&tx_sched) > 0) {
+            // Completions arrive within a frame time; triggers wait at most one tick meanwhile
+            uint32_t done = 0;
+            uint32_t failed = 0;
+            can_hal_tx_wait(portTICK_PERIOD_MS, &done, &failed);
+            can_tx_sched_complete(&tx_sched, done, failed, (uint64_t)app_clock_now_us());
+        } else {
+            ulTaskNotifyTake(pdTRUE, us_to_ticks(wait_us));
+        }
+    }
+}
+
+// Shifter silent for TIMING_SHIFTER_LOSS_MS: let the HID task release all buttons
+static void shifter_lost(void) {
+    ESP_LOGW(TAG, "Шифтер не отвечает более 2 секунд");
+    // Reset state initialization flag so the next frame re-syncs the HID side
+    shifter_state_initialized = false;
+    bmw_shifter_state_t state;
+    bmw_state_snapshot_read(&shifter_snapshot, &state);
+    post_shift_event(SHIFT_EVENT_DISCONNECT, &state, BMW_MANUAL_NONE, 0);
+}
+
+// CAN receive task
+// Send per-ID receive counters (one message per ID, plus one for IDs the table could not hold)
+static void send_can_stats(void) {
+    can_hal_id_stats_t stats[CAN_HAL_STATS_SLOTS];
+    uint32_t untracked = 0;
+    size_t count = can_hal_get_id_stats(stats, CAN_HAL_STATS_SLOTS, &untracked);
+    uint32_t now = (uint32_t)esp_timer_get_time();
     
-    esp_err_t ret = twai_transmit(&msg, pdMS_TO_TICKS(10));
-    if (ret != ESP_OK) {
-        ESP_LOGW(TAG, "Failed to send backlight: %s", esp_err_to_name(ret));
+    for (size_t i = 0; i < count; i++) {
+        serial_send_can_stats((uint16_t)stats[i].id, can_hal_filter_accepts(stats[i].id, 0),
+                              stats[i].accepted, stats[i].rejected, now);
     }
+    serial_send_can_stats(SERIAL_CAN_STATS_UNTRACKED, false, untracked, 0, now);
 }
 
-void timer_heartbeat_callback(TimerHandle_t xTimer) {
-    twai_message_t msg;
-    msg.identifier = CAN_ID_GEAR_LEVER_HEARTBEAT;
-    msg.flags = 0;
-    msg.data_length_code = sizeof(heartbeat_msg);
-    memcpy(msg.data, &heartbeat_msg, sizeof(heartbeat_msg));
+// Send p50/p99/max of every latency stage (one message per stage)
+static void send_latency_report(bool reset) {
+    latency_probe_t probe;  // One at a time, the histograms are not small
+    uint32_t now = (uint32_t)esp_timer_get_time();
     
-    esp_err_t ret = twai_transmit(&msg, pdMS_TO_TICKS(10));
-    if (ret != ESP_OK) {
-        ESP_LOGW(TAG, "Failed to send heartbeat: %s", esp_err_to_name(ret));
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        get_latency((latency_stage_t)stage, &probe, reset);
+        serial_send_latency((uint8_t)stage, latency_stage_names[stage], probe.count,
+                            latency_probe_percentile_us(&probe, 500), latency_probe_percentile_us(&probe, 990),
+                            probe.max_us, now);
+    }
+    if (reset) {
+        usb_hid_get_latency(NULL, NULL, true);
     }
 }
 
-// CAN receive task
 void can_rx_task(void *pvParameters) {
-    twai_message_t rx_msg;
-    static uint32_t last_can_log_time = 0;
-    static uint32_t last_state_send_time = 0;
-    const uint32_t CAN_LOG_INTERVAL_MS = 500;  // Log CAN messages every 500ms max
-    const uint32_t STATE_SEND_INTERVAL_MS = 100;  // Send state updates every 100ms max
-    
+    can_frame_t rx_msg;
     while (1) {
-        esp_err_t ret = twai_receive(&rx_msg, pdMS_TO_TICKS(100));
+        can_hal_status_t ret = can_hal_receive(&rx_msg, 100);
         
-        if (ret == ESP_OK) {
-            uint32_t now = xTaskGetTickCount();
-            
-            // Send CAN message to serial port only for important IDs or with throttling
-            bool should_log = false;
-            if (rx_msg.identifier == CAN_ID_GEAR_LEVER_POSITION) {
-                // Always log gear lever position messages
-                should_log = true;
-            } else if ((now - last_can_log_time) > pdMS_TO_TICKS(CAN_LOG_INTERVAL_MS)) {
-                // Log other messages with throttling
-                should_log = true;
-                last_can_log_time = now;
+        if (can_stats_requested) {
+            can_stats_requested = false;
+            send_can_stats();
+        }
+        if (latency_requested) {
+            latency_requested = false;
+            send_latency_report(latency_reset_requested);
+        }
+        
+        if (ret == CAN_HAL_OK) {
+            // 0x197/0x55E keep the shifter connected; gear lever frames always go to the
+            // serial port, other IDs are throttled (shifter_link.h)
+            portENTER_CRITICAL(&shifter_link_lock);
+            bool lost = shifter_link_frame_seen(&shifter_link, rx_msg.id);
+            bool should_log = shifter_link_should_forward(&shifter_link, rx_msg.id);
+            portEXIT_CRITICAL(&shifter_link_lock);
+            if (lost) {
+                shifter_lost();  // Silent for too long between two checks of app_main
             }
             
             if (should_log) {
-                serial_send_can_rx(rx_msg.identifier, rx_msg.data, rx_msg.data_length_code);
+                serial_send_can_rx(rx_msg.id, rx_msg.data, rx_msg.dlc, (uint32_t)rx_msg.timestamp_us);
             }
             
             // Process gear lever position message (ID 0x197)
-            if (rx_msg.identifier == CAN_ID_GEAR_LEVER_POSITION && rx_msg.data_length_code >= 4) {
+            if (rx_msg.id == CAN_ID_GEAR_LEVER_POSITION && rx_msg.dlc >= 4) {
                 uint8_t lever_pos = rx_msg.data[2];
                 uint8_t park_button = rx_msg.data[3];
+                bool was_initialized = shifter_state_initialized;
+                
+                // Check CRC and counter (counted only, the frame is still used)
+                bmw_pkt_status_t pkt_status = bmw_verify_pkt(rx_msg.id, rx_msg.data, rx_msg.dlc);
+                if (pkt_status == BMW_PKT_BAD_CRC) {
+                    lever_crc_errors++;
+                } else if (pkt_status == BMW_PKT_COUNTER_SKIP) {
+                    lever_counter_skips++;
+                }
                 
                 // Update shifter state
-                bmw_process_lever_position(&shifter_state, lever_pos, park_button);
+                bmw_manual_shift_t manual_shift = bmw_process_lever_position(&shifter_state, lever_pos, park_button);
+                bmw_state_snapshot_publish(&shifter_snapshot, &shifter_state);
+                record_latency(&state_latency, (int64_t)rx_msg.timestamp_us);
                 
-                // Update HID buttons based on state changes (track state only, HID updates in separate task)
+                // Wake the HID side right away if anything it cares about changed
+                if (!was_initialized || manual_shift != BMW_MANUAL_NONE ||
+                    shifter_state.lever_position != prev_shifter_state.lever_position ||
+                    shifter_state.current_gear != prev_shifter_state.current_gear) {
+                    post_shift_event(SHIFT_EVENT_STATE, &shifter_state, manual_shift, (int64_t)rx_msg.timestamp_us);
+                }
+                
+                // Show a new gear indication on the shifter without waiting for the next period
+                static uint8_t last_display_ind = 0;
+                uint8_t display_ind = gear_indication_for_state(&shifter_state);
+                if (display_ind != last_display_ind) {
+                    last_display_ind = display_ind;
+                    portENTER_CRITICAL(&latency_lock);
+                    display_origin_us = (int64_t)rx_msg.timestamp_us;
+                    portEXIT_CRITICAL(&latency_lock);
+                    trigger_can_tx(tx_slot_gear_display);
+                }
+                
+                // Track state changes (HID updates happen in hid_update_task)
                 update_hid_buttons_from_shifter();
                 
                 // Send updated state to serial port with throttling
-                if ((now - last_state_send_time) > pdMS_TO_TICKS(STATE_SEND_INTERVAL_MS)) {
-                    serial_send_shifter_state(&shifter_state);
-                    last_state_send_time = now;
+                portENTER_CRITICAL(&shifter_link_lock);
+                bool send_state = shifter_link_should_send_state(&shifter_link);
+                portEXIT_CRITICAL(&shifter_link_lock);
+                if (send_state) {
+                    serial_send_shifter_state(&shifter_state, (uint32_t)rx_msg.timestamp_us);
                 }
                 
-                shifter_connected = true;
-                last_heartbeat_time = now;
-                ESP_LOGI(TAG, "Gear lever: pos=0x%02X park=%s gear=%d",
-                         lever_pos,
-                         park_button == PARK_BUTTON_PRESSED ? "pressed" : "normal",
-                         shifter_state.current_gear);
-            }
-            // Process heartbeat from shifter (ID 0x55E)
-            else if (rx_msg.identifier == CAN_ID_GEAR_LEVER_HEARTBEAT) {
-                shifter_connected = true;
-                last_heartbeat_time = now;
+                DLOG(GEAR_LEVER, lever_pos, park_button == PARK_BUTTON_PRESSED,
+                     (uint32_t)shifter_state.current_gear);
             }
-        } else if (ret == ESP_ERR_TIMEOUT) {
+        } else if (ret == CAN_HAL_ERR_TIMEOUT) {
             // Timeout is normal, continue
         } else {
-            ESP_LOGE(TAG, "CAN receive error: %s", esp_err_to_name(ret));
+            ESP_LOGE(TAG, "CAN receive error: %s", can_hal_status_name(ret));
         }
     }
 }
 
+// Serial protocol output goes to the TX ring, never to the UART directly
+static void serial_ring_writer(const void *data, size_t len) {
+    if (ring_buffer_write(&serial_tx_ring, data, len) && serial_tx_task_handle != NULL) {
+        xTaskNotifyGive(serial_tx_task_handle);
+    }
+}
+
+// Serial TX task - low priority, drains the TX ring to the serial transport (usb_cdc.h)
+void serial_tx_task(void *pvParameters) {
+    while (1) {
+        const uint8_t *data;
+        size_t len = ring_buffer_peek(&serial_tx_ring, &data);
+        if (len == 0) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);  // Sleep until serial_ring_writer() adds data
+            continue;
+        }
+#if USB_CDC_ENABLED
+        // Nobody listening: discard, as the UART would; a full TX FIFO is retried next tick
+        if (usb_cdc_connected()) {
+            len = usb_cdc_write(data, len);
+            if (len == 0) {
+                vTaskDelay(1);
+                continue;
+            }
+        }
+#else
+        fwrite(data, 1, len, stdout);
+        fflush(stdout);
+#endif
+        ring_buffer_consume(&serial_tx_ring, len);
+    }
+}
+
+// Deferred log drain - lowest priority, formats what the hot paths recorded with DLOG()
+#define LOG_DRAIN_INTERVAL_MS  20
+
+void log_drain_task(void *pvParameters) {
+    char message[128];
+    dlog_record_t record;
+    
+    while (1) {
+        while (dlog_read(&record)) {
+            const dlog_site_t *site = dlog_get_site(record.site);
+            if (site == NULL || dlog_format(&record, message, sizeof(message)) < 0) {
+                continue;
+            }
+            // Same layout as ESP_LOGx, with the time the record was taken
+            esp_log_write((esp_log_level_t)site->level, site->tag, "%c (%lu) %s: %s\n",
+                          "NEWIDV"[site->level], (unsigned long)(record.timestamp_us / 1000),
+                          site->tag, message);
+        }
+        vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL_MS));
+    }
+}
+
+// Apply one command from the app (called by the parser in serial_rx_task)
+static void apply_serial_command(const serial_command_t *cmd, void *ctx) {
+    (void) ctx;
+    switch (cmd->type) {
+        case SERIAL_CMD_SET_BACKLIGHT:
+            if (cmd->backlight_level != backlight_level) {
+                backlight_level = cmd->backlight_level;
+                ESP_LOGI(TAG, "Backlight level set to %u", backlight_level);
+                trigger_can_tx(tx_slot_backlight);
+            }
+            break;
+        case SERIAL_CMD_HID_BUTTON: {
+            int bit = usb_hid_button_bit((hid_button_t)cmd->hid_button);
+            esp_err_t ret = bit < 0 ? ESP_ERR_INVALID_ARG :
+                            cmd->hid_action == HID_ACTION_PRESS ? hid_pulse_press((uint8_t)bit) :
+                                                                  hid_pulse_release((uint8_t)bit);
+            if (ret == ESP_OK) {
+                ESP_LOGI(TAG, "HID button %d %s", cmd->hid_button,
+                        cmd->hid_action == 0 ? "pressed" : "released");
+            } else {
+                ESP_LOGW(TAG, "Failed to send HID button: %s", esp_err_to_name(ret));
+            }
+            break;
+        }
+        case SERIAL_CMD_SET_HID_POLL:
+#if USB_CDC_ENABLED
+            // The CDC port is part of the same USB device and goes away with it
+            if (cmd->hid_poll_ms != usb_hid_get_poll_interval()) {
+                ESP_LOGW(TAG, "HID poll %u ms: USB re-enumerates, the CDC serial port will drop and must be reopened",
+                         cmd->hid_poll_ms);
+            }
+#endif
+            usb_hid_set_poll_interval(cmd->hid_poll_ms);
+            break;
+        case SERIAL_CMD_GET_CAN_STATS:
+            can_stats_requested = true;  // Sent by can_rx_task, the serial TX ring producer
+            break;
+        case SERIAL_CMD_GET_LATENCY:
+            latency_reset_requested = cmd->reset;
+            latency_requested = true;
+            break;
+        default:
+            break;
+    }
+}
+
 // Serial receive task (for commands from app)
+// Commands are newline-terminated; a line without newline is taken as complete once the link goes idle.
 void serial_rx_task(void *pvParameters) {
+    static serial_parser_t parser;
     uint8_t buffer[256];
-    int len;
     
+    serial_parser_init(&parser, apply_serial_command, NULL);
+#if USB_CDC_ENABLED
     while (1) {
-        len = uart_read_bytes(UART_NUM_0, buffer, sizeof(buffer) - 1, pdMS_TO_TICKS(100));
+        // Blocks for the first byte, then returns everything already received
+        size_t len = usb_cdc_read(buffer, sizeof(buffer), 20);
         if (len > 0) {
-            buffer[len] = '\0';
-            
-            // Process JSON command
-            uint8_t new_backlight = backlight_level;
-            bmw_gear_t new_gear = shifter_state.current_gear;
-            int hid_button = -1;
-            int hid_action = -1;
-            
-            if (serial_process_received_data((char*)buffer, &new_backlight, &new_gear, &hid_button, &hid_action)) {
-                if (new_backlight != backlight_level) {
-                    backlight_level = new_backlight;
-                    ESP_LOGI(TAG, "Backlight level set to %u", backlight_level);
-                }
-                
-                // Process HID button command
-                if (hid_button >= 0 && hid_action >= 0) {
-                    esp_err_t ret = usb_hid_send_button((hid_button_t)hid_button, (hid_action_t)hid_action);
-                    if (ret == ESP_OK) {
-                        ESP_LOGI(TAG, "HID button %d %s", hid_button, 
-                                hid_action == 0 ? "pressed" : "released");
-                    } else {
-                        ESP_LOGW(TAG, "Failed to send HID button: %s", esp_err_to_name(ret));
-                    }
+            serial_parser_feed(&parser, buffer, len);
+        } else {
+            serial_parser_flush(&parser);
+        }
+    }
+#else
+    int len;
+    while (1) {
+        // Block for the first byte, then take whatever else is already buffered
+        len = uart_read_bytes(UART_NUM_0, buffer, 1, pdMS_TO_TICKS(20));
+        if (len > 0) {
+            size_t available = 0;
+            uart_get_buffered_data_len(UART_NUM_0, &available);
+            if (available > sizeof(buffer) - 1) {
+                available = sizeof(buffer) - 1;
+            }
+            if (available > 0) {
+                int more = uart_read_bytes(UART_NUM_0, buffer + 1, available, 0);
+                if (more > 0) {
+                    len += more;
                 }
             }
+            serial_parser_feed(&parser, buffer, (size_t)len);
+        } else {
+            serial_parser_flush(&parser);
         }
     }
+#endif
 }
 
-// USB HID task (must be called periodically)
-void usb_hid_task_wrapper(void *pvParameters) {
-    while (1) {
-        usb_hid_task();
-        vTaskDelay(pdMS_TO_TICKS(1)); // TinyUSB task should be called frequently
-    }
-}
+// Task layout: core, priority and stack size of every task
+// The low-latency profile (default) keeps the CAN RX -> HID path alone on the last
+// core, above everything else there, while CAN TX, serial and logging share core 0
+// with the TWAI and USB interrupts installed by app_main. TASK_LAYOUT_LOW_LATENCY 0
+// restores the original unpinned layout. Compare the two with the latency report
+// logged every 10 s. The TinyUSB device task is created by esp_tinyusb with
+// USB_TASK_PRIORITY / USB_TASK_CORE.
+#ifndef TASK_LAYOUT_LOW_LATENCY
+#define TASK_LAYOUT_LOW_LATENCY  1
+#endif
+#define RT_CORE                  (portNUM_PROCESSORS - 1)
+
+typedef struct {
+    TaskFunction_t fn;
+    const char *name;
+    uint32_t stack;
+    UBaseType_t priority;
+    BaseType_t core;             // tskNO_AFFINITY lets the scheduler pick
+    TaskHandle_t *handle;
+} app_task_t;
+
+#if TASK_LAYOUT_LOW_LATENCY
+#define TASK_LAYOUT_NAME         "low-latency"
+static const app_task_t app_tasks[] = {
+    {can_rx_task,          "can_rx",     4096, 10, RT_CORE, NULL},
+    {hid_update_task,      "hid_update", 4096, 9,  RT_CORE, NULL},
+    {can_tx_task,          "can_tx",     3072, 7,  0,       &can_tx_task_handle},
+    {serial_rx_task,       "serial_rx",  2048, 4,  0,       NULL},
+    {serial_tx_task,       "serial_tx",  2048, 2,  0,       &serial_tx_task_handle},
+    {log_drain_task,       "log_drain",  3072, 1,  0,       NULL},
+};
+#define USB_TASK_PRIORITY        8
+#define USB_TASK_CORE            RT_CORE
+#else
+#define TASK_LAYOUT_NAME         "unpinned"
+static const app_task_t app_tasks[] = {
+    {can_tx_task,          "can_tx",     3072, 6,  tskNO_AFFINITY, &can_tx_task_handle},
+    {can_rx_task,          "can_rx",     4096, 5,  tskNO_AFFINITY, NULL},
+    {serial_rx_task,       "serial_rx",  2048, 5,  tskNO_AFFINITY, NULL},
+    {serial_tx_task,       "serial_tx",  2048, 2,  tskNO_AFFINITY, &serial_tx_task_handle},
+    {log_drain_task,       "log_drain",  3072, 1,  tskNO_AFFINITY, NULL},
+    {hid_update_task,      "hid_update", 4096, 5,  tskNO_AFFINITY, NULL},
+};
+#define USB_TASK_PRIORITY        5
+#define USB_TASK_CORE            tskNO_AFFINITY
+#endif
 
 void app_main(void)
 {
     ESP_LOGI(TAG, "Инициализация BMW Shifter Controller...");
     
+    // Hot-path logging is recorded raw and formatted by log_drain_task
+    dlog_init(app_clock_now_us);
+    
     // Initialize shifter state
     bmw_shifter_init(&shifter_state);
     bmw_shifter_init(&prev_shifter_state);  // Initialize previous state
+    bmw_state_snapshot_init(&shifter_snapshot, &shifter_state);
     shifter_state_initialized = false;  // Mark as not initialized until first update
+    shifter_link_init(&shifter_link);
     
     // Initialize USB HID
     ESP_LOGI(TAG, "Инициализация USB HID...");
-    ESP_ERROR_CHECK(usb_hid_init());
+    ESP_ERROR_CHECK(usb_hid_init(USB_TASK_PRIORITY, USB_TASK_CORE));
+    ESP_ERROR_CHECK(hid_pulse_init());
     
+#if USB_CDC_ENABLED
+    // Serial protocol on the CDC-ACM interface of the same USB device
+    ESP_ERROR_CHECK(usb_cdc_init());
+#else
     // Configure UART for serial communication
     uart_config_t uart_config = {
         .baud_rate = 115200,
@@ -388,43 +895,55 @@ void app_main(void)
     };
     ESP_ERROR_CHECK(uart_driver_install(UART_NUM_0, 1024, 1024, 0, NULL, 0));
     ESP_ERROR_CHECK(uart_param_config(UART_NUM_0, &uart_config));
+#endif
     
-    // Configure TWAI
-    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(GPIO_NUM_5, GPIO_NUM_4, TWAI_MODE_NORMAL);
-    twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
-    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    // Serial protocol output is queued and written by serial_tx_task
+    ring_buffer_init(&serial_tx_ring, serial_tx_storage, sizeof(serial_tx_storage));
+    serial_set_writer(serial_ring_writer);
     
+    // Configure TWAI
     ESP_LOGI(TAG, "Установка TWAI драйвера...");
-    ESP_ERROR_CHECK(twai_driver_install(&g_config, &t_config, &f_config));
-    ESP_ERROR_CHECK(twai_start());
+    can_hal_set_backend(&can_hal_twai_backend);
+#if !CAN_SNIFFER_MODE
+    can_hal_set_filter(can_rx_ids, sizeof(can_rx_ids) / sizeof(can_rx_ids[0]));
+#endif
+    ESP_ERROR_CHECK(can_hal_twai_start(GPIO_NUM_5, GPIO_NUM_4));
     
-    ESP_LOGI(TAG, "TWAI драйвер запущен. TX GPIO: %d, RX GPIO: %d", g_config.tx_io, g_config.rx_io);
+    ESP_LOGI(TAG, "TWAI драйвер запущен. TX GPIO: %d, RX GPIO: %d", GPIO_NUM_5, GPIO_NUM_4);
     
     // Initialize CAN message structures
-    gear_display_msg.counter_and_flags = 0x00;
-    gear_display_msg.gear_indication = GEAR_IND_P;
-    current_gear_indication = GEAR_IND_P;  // Initialize gear indication
+    if (!bmw_tx_cache_init(&gear_display_cache)) {
+        ESP_LOGE(TAG, "Failed to precompute gear display frames");
+    }
     
-    // Create timers for periodic CAN messages
-    timer_gear_display = xTimerCreate("GearDisplay", 
-                                      pdMS_TO_TICKS(TIMING_GEAR_DISPLAY_MS),
-                                      pdTRUE, NULL, timer_gear_display_callback);
-    timer_backlight = xTimerCreate("Backlight",
-                                   pdMS_TO_TICKS(TIMING_BACKLIGHT_MS),
-                                   pdTRUE, NULL, timer_backlight_callback);
-    timer_heartbeat = xTimerCreate("Heartbeat",
-                                   pdMS_TO_TICKS(TIMING_HEARTBEAT_MS),
-                                   pdTRUE, NULL, timer_heartbeat_callback);
+    // Shift event queue between can_rx_task and hid_update_task
+    shift_event_queue = xQueueCreate(SHIFT_EVENT_QUEUE_LEN, sizeof(shift_event_t));
+    configASSERT(shift_event_queue != NULL);
+    shift_queue_init(&shift_fifo, HID_PULSE_WIDTH_US, SHIFT_GAP_US);
+    const esp_timer_create_args_t shift_wake_args = {
+        .callback = shift_wake_callback,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "shift_wake",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&shift_wake_args, &shift_wake_timer));
     
-    xTimerStart(timer_gear_display, 0);
-    xTimerStart(timer_backlight, 0);
-    xTimerStart(timer_heartbeat, 0);
+    // Periodic CAN messages, all owned by can_tx_task
+    can_tx_sched_init(&tx_sched);
+    uint64_t start_us = (uint64_t)app_clock_now_us();
+    tx_slot_gear_display = can_tx_sched_add(&tx_sched, CAN_ID_DISPLAY_GEAR, TIMING_GEAR_DISPLAY_MS * 1000,
+                                            build_gear_display_frame, NULL, start_us + TIMING_GEAR_DISPLAY_MS * 1000);
+    tx_slot_backlight = can_tx_sched_add(&tx_sched, CAN_ID_BACKLIGHT, TIMING_BACKLIGHT_MS * 1000,
+                                         build_backlight_frame, NULL, start_us + TIMING_BACKLIGHT_MS * 1000);
+    can_tx_sched_add(&tx_sched, CAN_ID_GEAR_LEVER_HEARTBEAT, TIMING_HEARTBEAT_MS * 1000,
+                     build_heartbeat_frame, NULL, start_us + TIMING_HEARTBEAT_MS * 1000);
     
     // Create tasks
-    xTaskCreate(can_rx_task, "can_rx", 4096, NULL, 5, NULL);
-    xTaskCreate(serial_rx_task, "serial_rx", 2048, NULL, 5, NULL);
-    xTaskCreate(usb_hid_task_wrapper, "usb_hid", 4096, NULL, 5, NULL);
-    xTaskCreate(hid_update_task, "hid_update", 4096, NULL, 5, NULL);
+    ESP_LOGI(TAG, "Task layout: %s", TASK_LAYOUT_NAME);
+    for (size_t i = 0; i < sizeof(app_tasks) / sizeof(app_tasks[0]); i++) {
+        const app_task_t *t = &app_tasks[i];
+        BaseType_t ok = xTaskCreatePinnedToCore(t->fn, t->name, t->stack, NULL, t->priority, t->handle, t->core);
+        configASSERT(ok == pdPASS);
+    }
     
     ESP_LOGI(TAG, "Система инициализирована. Ожидание сообщений от шифтера...");
     ESP_LOGI(TAG, "USB HID устройство готово. Подключите второй USB порт к компьютеру.");
@@ -433,33 +952,116 @@ void app_main(void)
     while (1) {
         vTaskDelay(pdMS_TO_TICKS(1000));
         
-        // Check shifter connection status
-        static bool was_connected = false;
-        uint32_t now = xTaskGetTickCount();
-        if (shifter_connected && (now - last_heartbeat_time > pdMS_TO_TICKS(2000))) {
-            ESP_LOGW(TAG, "Шифтер не отвечает более 2 секунд");
-            shifter_connected = false;
+        // Report 0x197 integrity problems when they change
+        static uint32_t reported_crc_errors = 0;
+        static uint32_t reported_counter_skips = 0;
+        if (lever_crc_errors != reported_crc_errors || lever_counter_skips != reported_counter_skips) {
+            reported_crc_errors = lever_crc_errors;
+            reported_counter_skips = lever_counter_skips;
+            ESP_LOGW(TAG, "0x197: %lu CRC errors, %lu counter gaps",
+                     (unsigned long)reported_crc_errors, (unsigned long)reported_counter_skips);
+        }
+        
+        // Report frames the TWAI driver lost before can_rx_task got them (bus load, slow RX task)
+        static can_hal_rx_loss_t reported_rx_loss = {0};
+        can_hal_rx_loss_t rx_loss;
+        if (can_hal_get_rx_loss(&rx_loss) == CAN_HAL_OK &&
+            (rx_loss.queue_full != reported_rx_loss.queue_full || rx_loss.fifo_overrun != reported_rx_loss.fifo_overrun)) {
+            reported_rx_loss = rx_loss;
+            ESP_LOGW(TAG, "CAN RX lost: %lu RX queue full, %lu FIFO overrun",
+                     (unsigned long)rx_loss.queue_full, (unsigned long)rx_loss.fifo_overrun);
         }
         
-        // If connection lost, release all HID buttons
-        if (was_connected && !shifter_connected && usb_hid_is_ready()) {
-            ESP_LOGI(TAG, "HID: Releasing all buttons due to connection loss");
-            // Release all gear buttons
-            usb_hid_send_button(HID_BUTTON_P, HID_ACTION_RELEASE);
-            usb_hid_send_button(HID_BUTTON_R, HID_ACTION_RELEASE);
-            usb_hid_send_button(HID_BUTTON_N, HID_ACTION_RELEASE);
-            usb_hid_send_button(HID_BUTTON_D, HID_ACTION_RELEASE);
-            usb_hid_send_button(HID_BUTTON_M, HID_ACTION_RELEASE);
-            usb_hid_send_button(HID_BUTTON_PLUS, HID_ACTION_RELEASE);
-            usb_hid_send_button(HID_BUTTON_MINUS, HID_ACTION_RELEASE);
-            // Reset state initialization flag and gear indication
-            shifter_state_initialized = false;
-            current_gear_indication = 0;  // Reset to trigger update on reconnect
-            // Reset button press state
-            button_is_pressed = false;
-            button_press_time = 0;
-            button_should_hold = false;
+        // Report serial TX ring overflows
+        static uint32_t reported_dropped_bytes = 0;
+        ring_buffer_stats_t ring_stats;
+        ring_buffer_get_stats(&serial_tx_ring, &ring_stats);
+        if (ring_stats.dropped_bytes != reported_dropped_bytes) {
+            reported_dropped_bytes = ring_stats.dropped_bytes;
+            ESP_LOGW(TAG, "Serial TX ring: %lu bytes dropped (%lu messages), high-water %u/%u",
+                     (unsigned long)ring_stats.dropped_bytes, (unsigned long)ring_stats.dropped_writes,
+                     (unsigned)ring_stats.high_water, (unsigned)ring_stats.size);
+        }
+        
+        // Deferred log records lost because log_drain_task fell behind
+        static uint32_t reported_log_dropped = 0;
+        uint32_t log_dropped = dlog_dropped();
+        if (log_dropped != reported_log_dropped) {
+            reported_log_dropped = log_dropped;
+            ESP_LOGW(TAG, "Deferred log: %lu records dropped", (unsigned long)log_dropped);
+        }
+        
+        // CAN TX timing summary every 10 s
+        static uint32_t tx_report_seconds = 0;
+        if (++tx_report_seconds >= 10) {
+            tx_report_seconds = 0;
+            can_tx_stats_t tx_stats[CAN_TX_SCHED_MAX_FRAMES];
+            portENTER_CRITICAL(&tx_stats_lock);
+            size_t tx_count = tx_stats_published_count;
+            memcpy(tx_stats, tx_stats_published, tx_count * sizeof(tx_stats[0]));
+            portEXIT_CRITICAL(&tx_stats_lock);
+            for (size_t i = 0; i < tx_count; i++) {
+                const can_tx_stats_t st = tx_stats[i];
+                if (st.jitter_samples == 0) {
+                    continue;
+                }
+                ESP_LOGI(TAG, "TX 0x%03lX: sent %lu failed %lu queue_full %lu events %lu, jitter %ld/%lu/%ld us (min/avg abs/max)",
+                         (unsigned long)st.id, (unsigned long)st.sent, (unsigned long)st.failed,
+                         (unsigned long)st.queue_full, (unsigned long)st.events,
+                         (long)st.jitter_min_us, (unsigned long)(st.jitter_abs_sum_us / st.jitter_samples),
+                         (long)st.jitter_max_us);
+            }
+            
+            // Serial TX ring headroom, also when nothing was dropped
+            ESP_LOGI(TAG, "Serial TX ring: high-water %u/%u, %lu bytes dropped",
+                     (unsigned)ring_stats.high_water, (unsigned)ring_stats.size,
+                     (unsigned long)ring_stats.dropped_bytes);
+            
+            // CAN-to-HID latency of the current task layout (since boot or the last reset)
+            static latency_probe_t probe;  // Histograms are too big for this stack
+            for (int stage = LATENCY_STAGE_HID_TASK; stage <= LATENCY_STAGE_HID_COMPLETE; stage++) {
+                get_latency((latency_stage_t)stage, &probe, false);
+                if (probe.count > 0) {
+                    ESP_LOGI(TAG, "Latency [%s] %s: p50 %lu p99 %lu max %lu us (%lu)",
+                             TASK_LAYOUT_NAME, latency_stage_names[stage],
+                             (unsigned long)latency_probe_percentile_us(&probe, 500),
+                             (unsigned long)latency_probe_percentile_us(&probe, 990),
+                             (unsigned long)probe.max_us, (unsigned long)probe.count);
+                }
+            }
+        }
+        
+        // Report HID queue overflows (a press/release edge may have been merged away)
+        static uint32_t reported_hid_overflows = 0;
+        usb_hid_stats_t hid_stats;
+        usb_hid_get_stats(&hid_stats);
+        if (hid_stats.overflowed != reported_hid_overflows) {
+            reported_hid_overflows = hid_stats.overflowed;
+            ESP_LOGW(TAG, "HID report queue overflowed %lu times (sent %lu, coalesced %lu)",
+                     (unsigned long)hid_stats.overflowed, (unsigned long)hid_stats.sent,
+                     (unsigned long)hid_stats.coalesced);
+        }
+        
+        // Report M-mode shift playback (a shift is dropped only if a queue overflowed or the shifter was lost)
+        static shift_queue_stats_t reported_shifts = {0};
+        portENTER_CRITICAL(&shift_overflow_lock);
+        shift_queue_stats_t shift_stats = shift_stats_published;
+        shift_stats.dropped += shift_posts_dropped;
+        portEXIT_CRITICAL(&shift_overflow_lock);
+        if (shift_stats.queued != reported_shifts.queued || shift_stats.played != reported_shifts.played ||
+            shift_stats.dropped != reported_shifts.dropped) {
+            reported_shifts = shift_stats;
+            ESP_LOGI(TAG, "Manual shifts: queued %lu played %lu dropped %lu pending %u",
+                     (unsigned long)shift_stats.queued, (unsigned long)shift_stats.played,
+                     (unsigned long)shift_stats.dropped, (unsigned)shift_stats.pending);
+        }
+        
+        // Check shifter connection status
+        portENTER_CRITICAL(&shifter_link_lock);
+        bool lost = shifter_link_check_loss(&shifter_link);
+        portEXIT_CRITICAL(&shifter_link_lock);
+        if (lost) {
+            shifter_lost();
         }
-        was_connected = shifter_connected;
     }
 }
@@ -0,0 +1,89 @@
+#include "ring_buffer.h"
+#include <string.h>
+
+/**
+ * Initialize a ring over caller-provided storage
+ * 
+ * @param size Storage size in bytes, must be a power of two
+ */
+bool ring_buffer_init(ring_buffer_t *rb, uint8_t *storage, size_t size) {
+    if (rb == NULL || storage == NULL || size == 0 || (size & (size - 1)) != 0) {
+        return false;
+    }
+    rb->buf = storage;
+    rb->size = size;
+    atomic_init(&rb->head, 0);
+    atomic_init(&rb->tail, 0);
+    atomic_init(&rb->dropped_bytes, 0);
+    atomic_init(&rb->dropped_writes, 0);
+    atomic_init(&rb->high_water, 0);
+    return true;
+}
+
+/**
+ * Queue len bytes (producer side, never blocks)
+ * 
+ * @return false if there was not enough room; nothing is written then
+ */
+bool ring_buffer_write(ring_buffer_t *rb, const void *data, size_t len) {
+    size_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    size_t used = head - tail;
+
+    if (len > rb->size - used) {
+        atomic_fetch_add_explicit(&rb->dropped_bytes, (uint_least32_t)len, memory_order_relaxed);
+        atomic_fetch_add_explicit(&rb->dropped_writes, 1, memory_order_relaxed);
+        return false;
+    }
+
+    size_t offset = head & (rb->size - 1);
+    size_t first = rb->size - offset;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&rb->buf[offset], data, first);
+    memcpy(rb->buf, (const uint8_t *)data + first, len - first);
+    atomic_store_explicit(&rb->head, head + len, memory_order_release);
+
+    if (used + len > atomic_load_explicit(&rb->high_water, memory_order_relaxed)) {
+        atomic_store_explicit(&rb->high_water, used + len, memory_order_relaxed);
+    }
+    return true;
+}
+
+/**
+ * Get the largest contiguous readable block (consumer side)
+ * 
+ * @return Number of bytes available at *data (0 if the ring is empty)
+ */
+size_t ring_buffer_peek(ring_buffer_t *rb, const uint8_t **data) {
+    size_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+    size_t used = head - tail;
+    size_t offset = tail & (rb->size - 1);
+    size_t contiguous = rb->size - offset;
+
+    *data = &rb->buf[offset];
+    return used < contiguous ? used : contiguous;
+}
+
+/**
+ * Release len bytes previously returned by ring_buffer_peek (consumer side)
+ */
+void ring_buffer_consume(ring_buffer_t *rb, size_t len) {
+    size_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+    atomic_store_explicit(&rb->tail, tail + len, memory_order_release);
+}
+
+size_t ring_buffer_used(ring_buffer_t *rb) {
+    return atomic_load_explicit(&rb->head, memory_order_acquire) -
+           atomic_load_explicit(&rb->tail, memory_order_acquire);
+}
+
+void ring_buffer_get_stats(ring_buffer_t *rb, ring_buffer_stats_t *stats) {
+    stats->size = rb->size;
+    stats->used = ring_buffer_used(rb);
+    stats->high_water = atomic_load_explicit(&rb->high_water, memory_order_relaxed);
+    stats->dropped_bytes = atomic_load_explicit(&rb->dropped_bytes, memory_order_relaxed);
+    stats->dropped_writes = atomic_load_explicit(&rb->dropped_writes, memory_order_relaxed);
+}
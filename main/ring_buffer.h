@@ -0,0 +1,46 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Lock-free single-producer / single-consumer byte ring
+// The producer only writes head, the consumer only writes tail. Writes are
+// all-or-nothing, so a message is either queued whole or counted as dropped.
+typedef struct {
+    uint8_t *buf;
+    size_t size;                  // Capacity in bytes, power of two
+    atomic_size_t head;           // Total bytes written (producer)
+    atomic_size_t tail;           // Total bytes read (consumer)
+    atomic_uint_least32_t dropped_bytes;
+    atomic_uint_least32_t dropped_writes;
+    atomic_size_t high_water;     // Highest fill level seen by the producer
+} ring_buffer_t;
+
+typedef struct {
+    size_t size;
+    size_t used;
+    size_t high_water;
+    uint32_t dropped_bytes;
+    uint32_t dropped_writes;
+} ring_buffer_stats_t;
+
+// Function declarations
+bool ring_buffer_init(ring_buffer_t *rb, uint8_t *storage, size_t size);
+bool ring_buffer_write(ring_buffer_t *rb, const void *data, size_t len);
+size_t ring_buffer_peek(ring_buffer_t *rb, const uint8_t **data);
+void ring_buffer_consume(ring_buffer_t *rb, size_t len);
+size_t ring_buffer_used(ring_buffer_t *rb);
+void ring_buffer_get_stats(ring_buffer_t *rb, ring_buffer_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RING_BUFFER_H
@@ -3,8 +3,95 @@
 #include <string.h>
 #include <stdlib.h>
 
+static serial_format_t output_format = SERIAL_FORMAT_JSON;
+
+// Default output: stdout (used by host tools)
+static void stdout_writer(const void *data, size_t len) {
+    fwrite(data, 1, len, stdout);
+    fflush(stdout);
+}
+
+static serial_write_fn_t output_writer = stdout_writer;
+
+void serial_set_writer(serial_write_fn_t writer) {
+    output_writer = writer != NULL ? writer : stdout_writer;
+}
+
+void serial_set_format(serial_format_t format) {
+    output_format = format;
+}
+
+serial_format_t serial_get_format(void) {
+    return output_format;
+}
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+static uint16_t crc16_ccitt(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// COBS encode len bytes (len < 254) into out, append the 0x00 delimiter, return encoded length
+static size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t code_pos = 0;
+    size_t out_pos = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == 0) {
+            out[code_pos] = code;
+            code_pos = out_pos++;
+            code = 1;
+        } else {
+            out[out_pos++] = in[i];
+            code++;
+        }
+    }
+    out[code_pos] = code;
+    out[out_pos++] = 0x00;
+    return out_pos;
+}
+
+// Finish a binary record (header already in record[0..5]), append CRC and write it out
+static void send_binary_record(uint8_t *record, size_t len) {
+    uint16_t crc = crc16_ccitt(record, len);
+    record[len++] = (uint8_t)(crc & 0xFF);
+    record[len++] = (uint8_t)(crc >> 8);
+
+    uint8_t frame[SERIAL_BIN_MAX_RECORD + 2];  // COBS overhead + delimiter
+    size_t frame_len = cobs_encode(record, len, frame);
+    output_writer(frame, frame_len);
+}
+
+static size_t put_binary_header(uint8_t *record, serial_msg_type_t type, uint32_t timestamp_us) {
+    record[0] = SERIAL_BIN_VERSION;
+    record[1] = (uint8_t)type;
+    record[2] = (uint8_t)(timestamp_us);
+    record[3] = (uint8_t)(timestamp_us >> 8);
+    record[4] = (uint8_t)(timestamp_us >> 16);
+    record[5] = (uint8_t)(timestamp_us >> 24);
+    return 6;
+}
+
 // Simple JSON serialization (without external library)
-void serial_send_can_rx(uint16_t can_id, const uint8_t *data, uint8_t dlc) {
+void serial_send_can_rx(uint16_t can_id, const uint8_t *data, uint8_t dlc, uint32_t timestamp_us) {
+    if (output_format == SERIAL_FORMAT_BINARY) {
+        uint8_t record[SERIAL_BIN_MAX_RECORD];
+        uint8_t n = dlc > 8 ? 8 : dlc;
+        size_t len = put_binary_header(record, SERIAL_MSG_CAN_RX, timestamp_us);
+        record[len++] = (uint8_t)(can_id & 0xFF);
+        record[len++] = (uint8_t)(can_id >> 8);
+        record[len++] = n;
+        memcpy(&record[len], data, n);
+        send_binary_record(record, len + n);
+        return;
+    }
+    
     char json[256];
     int len = snprintf(json, sizeof(json),
         "{\"type\":\"can_rx\",\"id\":%u,\"data\":[",
@@ -17,11 +104,24 @@ void serial_send_can_rx(uint16_t can_id, const uint8_t *data, uint8_t dlc) {
     
     len += snprintf(json + len, sizeof(json) - len, "],\"dlc\":%u}\n", dlc);
     
-    printf("%s", json);
-    fflush(stdout);
+    if (len >= (int)sizeof(json)) {
+        len = sizeof(json) - 1;
+    }
+    output_writer(json, (size_t)len);
 }
 
-void serial_send_shifter_state(const bmw_shifter_state_t *state) {
+void serial_send_shifter_state(const bmw_shifter_state_t *state, uint32_t timestamp_us) {
+    if (output_format == SERIAL_FORMAT_BINARY) {
+        uint8_t record[SERIAL_BIN_MAX_RECORD];
+        size_t len = put_binary_header(record, SERIAL_MSG_SHIFTER_STATE, timestamp_us);
+        record[len++] = (uint8_t)state->current_gear;
+        record[len++] = state->lever_position;
+        record[len++] = state->park_button;
+        record[len++] = state->manual_gear;
+        send_binary_record(record, len);
+        return;
+    }
+    
     const char *gear_str;
     switch (state->current_gear) {
         case GEAR_P: gear_str = "P"; break;
@@ -32,51 +132,150 @@ void serial_send_shifter_state(const bmw_shifter_state_t *state) {
         default: gear_str = "Unknown"; break;
     }
     
-    printf("{\"type\":\"shifter_state\",\"gear\":\"%s\",\"lever_pos\":0x%02X,\"park\":%s,\"manual\":%u}\n",
+    char json[128];
+    int len = snprintf(json, sizeof(json),
+           "{\"type\":\"shifter_state\",\"gear\":\"%s\",\"lever_pos\":0x%02X,\"park\":%s,\"manual\":%u}\n",
            gear_str,
            state->lever_position,
            state->park_button == PARK_BUTTON_PRESSED ? "true" : "false",
            state->manual_gear);
-    fflush(stdout);
+    if (len >= (int)sizeof(json)) {
+        len = sizeof(json) - 1;
+    }
+    output_writer(json, (size_t)len);
+}
+
+void serial_send_can_stats(uint16_t can_id, bool whitelisted, uint32_t accepted, uint32_t rejected,
+                           uint32_t timestamp_us) {
+    if (output_format == SERIAL_FORMAT_BINARY) {
+        uint8_t record[SERIAL_BIN_MAX_RECORD];
+        size_t len = put_binary_header(record, SERIAL_MSG_CAN_STATS, timestamp_us);
+        record[len++] = (uint8_t)(can_id & 0xFF);
+        record[len++] = (uint8_t)(can_id >> 8);
+        record[len++] = whitelisted ? 1 : 0;
+        for (int i = 0; i < 4; i++) {
+            record[len + i] = (uint8_t)(accepted >> (8 * i));
+            record[len + 4 + i] = (uint8_t)(rejected >> (8 * i));
+        }
+        send_binary_record(record, len + 8);
+        return;
+    }
+    
+    char json[128];
+    int len = snprintf(json, sizeof(json),
+           "{\"type\":\"can_stats\",\"id\":%u,\"whitelisted\":%s,\"accepted\":%lu,\"rejected\":%lu}\n",
+           can_id,
+           whitelisted ? "true" : "false",
+           (unsigned long)accepted,
+           (unsigned long)rejected);
+    if (len >= (int)sizeof(json)) {
+        len = sizeof(json) - 1;
+    }
+    output_writer(json, (size_t)len);
+}
+
+void serial_send_latency(uint8_t stage, const char *name, uint32_t count, uint32_t p50_us, uint32_t p99_us,
+                         uint32_t max_us, uint32_t timestamp_us) {
+    if (output_format == SERIAL_FORMAT_BINARY) {
+        uint8_t record[SERIAL_BIN_MAX_RECORD];
+        size_t len = put_binary_header(record, SERIAL_MSG_LATENCY, timestamp_us);
+        const uint32_t values[] = {count, p50_us, p99_us, max_us};
+        record[len++] = stage;
+        for (size_t v = 0; v < sizeof(values) / sizeof(values[0]); v++) {
+            for (int i = 0; i < 4; i++) {
+                record[len++] = (uint8_t)(values[v] >> (8 * i));
+            }
+        }
+        send_binary_record(record, len);
+        return;
+    }
+    
+    char json[160];
+    int len = snprintf(json, sizeof(json),
+           "{\"type\":\"latency\",\"stage\":\"%s\",\"count\":%lu,\"p50_us\":%lu,\"p99_us\":%lu,\"max_us\":%lu}\n",
+           name,
+           (unsigned long)count,
+           (unsigned long)p50_us,
+           (unsigned long)p99_us,
+           (unsigned long)max_us);
+    if (len >= (int)sizeof(json)) {
+        len = sizeof(json) - 1;
+    }
+    output_writer(json, (size_t)len);
 }
 
 // Simple JSON parser (basic implementation)
-bool serial_process_received_data(const char *json_str, uint8_t *backlight_level, bmw_gear_t *gear_indication,
-                                  int *hid_button, int *hid_action) {
-    if (backlight_level == NULL || gear_indication == NULL || hid_button == NULL || hid_action == NULL) {
+// line must be NUL-terminated; fills cmd and returns true for a recognised command
+bool serial_parse_command(const char *line, serial_command_t *cmd) {
+    if (line == NULL || cmd == NULL) {
         return false;
     }
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->hid_button = -1;
+    cmd->hid_action = -1;
     
     // Simple string matching for JSON parsing (without external library)
-    if (strstr(json_str, "\"type\":\"set_backlight\"") != NULL) {
+    if (strstr(line, "\"type\":\"set_format\"") != NULL) {
+        const char *format_str = strstr(line, "\"format\":\"");
+        if (format_str != NULL) {
+            if (strncmp(format_str + 10, "binary", 6) == 0) {
+                cmd->format = SERIAL_FORMAT_BINARY;
+            } else if (strncmp(format_str + 10, "json", 4) == 0) {
+                cmd->format = SERIAL_FORMAT_JSON;
+            } else {
+                return false;
+            }
+            cmd->type = SERIAL_CMD_SET_FORMAT;
+            return true;
+        }
+    } else if (strstr(line, "\"type\":\"get_can_stats\"") != NULL) {
+        cmd->type = SERIAL_CMD_GET_CAN_STATS;
+        return true;
+    } else if (strstr(line, "\"type\":\"get_latency\"") != NULL) {
+        cmd->type = SERIAL_CMD_GET_LATENCY;
+        cmd->reset = strstr(line, "\"reset\":true") != NULL;
+        return true;
+    } else if (strstr(line, "\"type\":\"set_hid_poll\"") != NULL) {
+        const char *interval_str = strstr(line, "\"interval_ms\":");
+        if (interval_str != NULL) {
+            int interval = atoi(interval_str + 14);
+            if (interval >= 1 && interval <= 255) {
+                cmd->type = SERIAL_CMD_SET_HID_POLL;
+                cmd->hid_poll_ms = (uint8_t)interval;
+                return true;
+            }
+        }
+    } else if (strstr(line, "\"type\":\"set_backlight\"") != NULL) {
         // Parse backlight level
-        const char *level_str = strstr(json_str, "\"level\":");
+        const char *level_str = strstr(line, "\"level\":");
         if (level_str != NULL) {
             int level = atoi(level_str + 8);
             if (level >= BACKLIGHT_MIN && level <= BACKLIGHT_MAX) {
-                *backlight_level = (uint8_t)level;
+                cmd->type = SERIAL_CMD_SET_BACKLIGHT;
+                cmd->backlight_level = (uint8_t)level;
                 return true;
             }
         }
-    } else if (strstr(json_str, "\"type\":\"set_gear_indication\"") != NULL) {
+    } else if (strstr(line, "\"type\":\"set_gear_indication\"") != NULL) {
         // Parse gear indication
-        const char *gear_str = strstr(json_str, "\"gear\":\"");
+        const char *gear_str = strstr(line, "\"gear\":\"");
         if (gear_str != NULL) {
-            char gear_char = gear_str[9];
+            char gear_char = gear_str[8];
             switch (gear_char) {
-                case 'P': *gear_indication = GEAR_P; break;
-                case 'R': *gear_indication = GEAR_R; break;
-                case 'N': *gear_indication = GEAR_N; break;
-                case 'D': *gear_indication = GEAR_D; break;
-                case 'M': *gear_indication = GEAR_M; break;
+                case 'P': cmd->gear = GEAR_P; break;
+                case 'R': cmd->gear = GEAR_R; break;
+                case 'N': cmd->gear = GEAR_N; break;
+                case 'D': cmd->gear = GEAR_D; break;
+                case 'M': cmd->gear = GEAR_M; break;
                 default: return false;
             }
+            cmd->type = SERIAL_CMD_SET_GEAR_INDICATION;
             return true;
         }
-    } else if (strstr(json_str, "\"type\":\"hid_button\"") != NULL) {
+    } else if (strstr(line, "\"type\":\"hid_button\"") != NULL) {
         // Parse HID button command
-        const char *button_str = strstr(json_str, "\"button\":\"");
-        const char *action_str = strstr(json_str, "\"action\":\"");
+        const char *button_str = strstr(line, "\"button\":\"");
+        const char *action_str = strstr(line, "\"action\":\"");
         
         if (button_str != NULL && action_str != NULL) {
             char button_char = button_str[10];
@@ -106,11 +305,113 @@ bool serial_process_received_data(const char *json_str, uint8_t *backlight_level
                 return false;
             }
             
-            *hid_button = button;
-            *hid_action = action;
+            cmd->type = SERIAL_CMD_HID_BUTTON;
+            cmd->hid_button = button;
+            cmd->hid_action = action;
             return true;
         }
     }
     return false;
 }
 
+// Single-command entry point, kept for callers that already have a whole message
+bool serial_process_received_data(const char *json_str, uint8_t *backlight_level, bmw_gear_t *gear_indication,
+                                  int *hid_button, int *hid_action) {
+    if (backlight_level == NULL || gear_indication == NULL || hid_button == NULL || hid_action == NULL) {
+        return false;
+    }
+    
+    serial_command_t cmd;
+    if (!serial_parse_command(json_str, &cmd)) {
+        return false;
+    }
+    switch (cmd.type) {
+        case SERIAL_CMD_SET_FORMAT: serial_set_format(cmd.format); break;
+        case SERIAL_CMD_SET_BACKLIGHT: *backlight_level = cmd.backlight_level; break;
+        case SERIAL_CMD_SET_GEAR_INDICATION: *gear_indication = cmd.gear; break;
+        case SERIAL_CMD_HID_BUTTON:
+            *hid_button = cmd.hid_button;
+            *hid_action = cmd.hid_action;
+            break;
+        default: return false;
+    }
+    return true;
+}
+
+/**
+ * Reset a streaming parser; on_command is called once per complete command
+ */
+void serial_parser_init(serial_parser_t *parser, serial_command_fn_t on_command, void *ctx) {
+    memset(parser, 0, sizeof(*parser));
+    parser->on_command = on_command;
+    parser->ctx = ctx;
+}
+
+// Parse and dispatch the buffered line, then start a new one
+static bool parser_dispatch_line(serial_parser_t *parser) {
+    bool dispatched = false;
+    if (parser->len > 0 && !parser->overflow) {
+        serial_command_t cmd;
+        parser->line[parser->len] = '\0';
+        if (serial_parse_command(parser->line, &cmd)) {
+            // Output format is owned by this module, apply it before the callback sees it
+            if (cmd.type == SERIAL_CMD_SET_FORMAT) {
+                serial_set_format(cmd.format);
+            }
+            parser->commands++;
+            if (parser->on_command != NULL) {
+                parser->on_command(&cmd, parser->ctx);
+            }
+            dispatched = true;
+        } else {
+            parser->rejected++;
+        }
+    }
+    parser->len = 0;
+    parser->overflow = false;
+    return dispatched;
+}
+
+/**
+ * Consume received bytes, dispatching every newline-terminated command in order
+ * Partial lines are kept for the next call. Lines longer than SERIAL_PARSER_LINE_MAX
+ * are discarded up to the next newline. Returns the number of commands dispatched.
+ */
+size_t serial_parser_feed(serial_parser_t *parser, const uint8_t *data, size_t len) {
+    size_t dispatched = 0;
+    while (len > 0) {
+        const uint8_t *nl = memchr(data, '\n', len);
+        size_t chunk = nl != NULL ? (size_t)(nl - data) : len;
+
+        // Append up to the newline (or the end of the data)
+        if (!parser->overflow) {
+            if (parser->len + chunk < sizeof(parser->line)) {
+                memcpy(parser->line + parser->len, data, chunk);
+                parser->len += chunk;
+            } else {
+                parser->overflow = true;
+                parser->overflows++;
+            }
+        }
+        if (nl == NULL) {
+            break;
+        }
+
+        // Accept CRLF line endings
+        if (parser->len > 0 && parser->line[parser->len - 1] == '\r') {
+            parser->len--;
+        }
+        dispatched += parser_dispatch_line(parser);
+        data += chunk + 1;
+        len -= chunk + 1;
+    }
+    return dispatched;
+}
+
+/**
+ * Treat buffered bytes as a complete line (for senders that do not terminate with a newline)
+ * Call after the link has been idle; returns true if a command was dispatched.
+ */
+bool serial_parser_flush(serial_parser_t *parser) {
+    return parser_dispatch_line(parser);
+}
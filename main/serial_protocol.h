@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "bmw_shifter.h"
 
 #ifdef __cplusplus
@@ -14,9 +15,76 @@ typedef enum {
     SERIAL_MSG_CAN_RX = 0,           // CAN message received
     SERIAL_MSG_SHIFTER_STATE,        // Shifter state update
     SERIAL_MSG_SET_BACKLIGHT,        // Set backlight level (from app)
-    SERIAL_MSG_SET_GEAR_INDICATION   // Set gear indication (from app)
+    SERIAL_MSG_SET_GEAR_INDICATION,  // Set gear indication (from app)
+    SERIAL_MSG_CAN_STATS,            // Per-ID CAN receive counters (reply to get_can_stats)
+    SERIAL_MSG_LATENCY               // Latency of one stage (reply to get_latency)
 } serial_msg_type_t;
 
+// Output format, selectable at runtime ({"type":"set_format","format":"binary"|"json"})
+typedef enum {
+    SERIAL_FORMAT_JSON = 0,   // One JSON object per line (default, human readable)
+    SERIAL_FORMAT_BINARY      // COBS framed binary records, see below
+} serial_format_t;
+
+// Binary record, COBS encoded and terminated by a 0x00 byte:
+//   byte 0     version (SERIAL_BIN_VERSION)
+//   byte 1     message type (serial_msg_type_t)
+//   byte 2-5   timestamp in microseconds (uint32, little endian, wraps)
+//   payload    SERIAL_MSG_CAN_RX:        id (uint16 LE), dlc, data[dlc]
+//              SERIAL_MSG_SHIFTER_STATE: gear, lever_pos, park_button, manual_gear
+//              SERIAL_MSG_CAN_STATS:     id (uint16 LE, 0xFFFF = untracked IDs), whitelisted,
+//                                        accepted (uint32 LE), rejected (uint32 LE)
+//              SERIAL_MSG_LATENCY:       stage, count, p50_us, p99_us, max_us (uint32 LE each)
+//   last 2     CRC-16/CCITT-FALSE over all previous bytes (little endian)
+// Log output on the same UART never contains 0x00, so a decoder resyncs on the
+// next delimiter and drops text fragments by their failing CRC.
+#define SERIAL_BIN_VERSION        1
+#define SERIAL_BIN_MAX_RECORD     25   // Largest record before COBS (latency)
+#define SERIAL_CAN_STATS_UNTRACKED  0xFFFF
+
+// Output sink for encoded messages (default: stdout)
+// Called from the task that sends the message, must not block for long.
+typedef void (*serial_write_fn_t)(const void *data, size_t len);
+
+// Commands from the app (one JSON object per line)
+typedef enum {
+    SERIAL_CMD_NONE = 0,
+    SERIAL_CMD_SET_FORMAT,           // {"type":"set_format","format":"binary"|"json"}
+    SERIAL_CMD_SET_BACKLIGHT,        // {"type":"set_backlight","level":N}
+    SERIAL_CMD_SET_GEAR_INDICATION,  // {"type":"set_gear_indication","gear":"P"}
+    SERIAL_CMD_HID_BUTTON,           // {"type":"hid_button","button":"P","action":"press"}
+    SERIAL_CMD_GET_CAN_STATS,        // {"type":"get_can_stats"}
+    SERIAL_CMD_SET_HID_POLL,         // {"type":"set_hid_poll","interval_ms":N}
+    SERIAL_CMD_GET_LATENCY           // {"type":"get_latency"} or {"type":"get_latency","reset":true}
+} serial_cmd_type_t;
+
+typedef struct {
+    serial_cmd_type_t type;
+    serial_format_t format;          // SERIAL_CMD_SET_FORMAT
+    uint8_t backlight_level;         // SERIAL_CMD_SET_BACKLIGHT
+    bmw_gear_t gear;                 // SERIAL_CMD_SET_GEAR_INDICATION
+    int hid_button;                  // SERIAL_CMD_HID_BUTTON (hid_button_t)
+    int hid_action;                  // SERIAL_CMD_HID_BUTTON (hid_action_t)
+    uint8_t hid_poll_ms;             // SERIAL_CMD_SET_HID_POLL (1-255)
+    bool reset;                      // SERIAL_CMD_GET_LATENCY: restart the histograms after the dump
+} serial_command_t;
+
+typedef void (*serial_command_fn_t)(const serial_command_t *cmd, void *ctx);
+
+// Streaming command parser - frames on '\n' (CRLF accepted), no allocation
+#define SERIAL_PARSER_LINE_MAX    128
+
+typedef struct {
+    char line[SERIAL_PARSER_LINE_MAX];
+    size_t len;
+    bool overflow;                   // Line too long, skipping to the next newline
+    serial_command_fn_t on_command;
+    void *ctx;
+    uint32_t commands;               // Commands dispatched
+    uint32_t rejected;               // Complete lines that were not a valid command
+    uint32_t overflows;              // Lines dropped for exceeding SERIAL_PARSER_LINE_MAX
+} serial_parser_t;
+
 // Serial message structure for CAN RX
 typedef struct {
     uint16_t can_id;
@@ -44,8 +112,19 @@ typedef struct {
 } serial_set_gear_indication_msg_t;
 
 // Function declarations
-void serial_send_can_rx(uint16_t can_id, const uint8_t *data, uint8_t dlc);
-void serial_send_shifter_state(const bmw_shifter_state_t *state);
+void serial_set_writer(serial_write_fn_t writer);
+void serial_set_format(serial_format_t format);
+serial_format_t serial_get_format(void);
+void serial_send_can_rx(uint16_t can_id, const uint8_t *data, uint8_t dlc, uint32_t timestamp_us);
+void serial_send_shifter_state(const bmw_shifter_state_t *state, uint32_t timestamp_us);
+void serial_send_can_stats(uint16_t can_id, bool whitelisted, uint32_t accepted, uint32_t rejected,
+                           uint32_t timestamp_us);
+void serial_send_latency(uint8_t stage, const char *name, uint32_t count, uint32_t p50_us, uint32_t p99_us,
+                         uint32_t max_us, uint32_t timestamp_us);
+bool serial_parse_command(const char *line, serial_command_t *cmd);
+void serial_parser_init(serial_parser_t *parser, serial_command_fn_t on_command, void *ctx);
+size_t serial_parser_feed(serial_parser_t *parser, const uint8_t *data, size_t len);
+bool serial_parser_flush(serial_parser_t *parser);
 bool serial_process_received_data(const char *json_str, uint8_t *backlight_level, bmw_gear_t *gear_indication, 
                                   int *hid_button, int *hid_action);
 
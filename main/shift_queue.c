@@ -0,0 +1,81 @@
+#include "shift_queue.h"
+#include <string.h>
+
+void shift_queue_init(shift_queue_t *q, uint32_t pulse_us, uint32_t gap_us) {
+    memset(q, 0, sizeof(*q));
+    q->pulse_us = pulse_us;
+    q->gap_us = gap_us;
+}
+
+/**
+ * Change pulse and gap for the shifts still to come (the running one keeps its slot)
+ */
+void shift_queue_set_timing(shift_queue_t *q, uint32_t pulse_us, uint32_t gap_us) {
+    q->pulse_us = pulse_us;
+    q->gap_us = gap_us;
+}
+
+/**
+ * Append a shift, counted as dropped if the FIFO is full
+ */
+bool shift_queue_push(shift_queue_t *q, bmw_manual_shift_t shift, int64_t origin_us) {
+    if (shift == BMW_MANUAL_NONE) {
+        return false;
+    }
+    if (q->count >= SHIFT_QUEUE_LEN) {
+        q->stats.dropped++;
+        return false;
+    }
+    shift_queue_item_t *item = &q->items[(q->head + q->count) % SHIFT_QUEUE_LEN];
+    item->shift = shift;
+    item->origin_us = origin_us;
+    q->count++;
+    q->stats.queued++;
+    return true;
+}
+
+/**
+ * Take the oldest shift if its slot has come
+ * The caller must start its pulse now; the next shift is held back for pulse + gap.
+ */
+bool shift_queue_next(shift_queue_t *q, uint64_t now_us, shift_queue_item_t *item) {
+    if (q->count == 0 || now_us < q->next_allowed_us) {
+        return false;
+    }
+    *item = q->items[q->head];
+    q->head = (q->head + 1) % SHIFT_QUEUE_LEN;
+    q->count--;
+    q->stats.played++;
+    q->next_allowed_us = now_us + q->pulse_us + q->gap_us;
+    return true;
+}
+
+/**
+ * Microseconds until shift_queue_next() can return a shift
+ *
+ * @return 0 if one is ready, SHIFT_QUEUE_NO_DEADLINE if the FIFO is empty
+ */
+uint32_t shift_queue_wait_us(const shift_queue_t *q, uint64_t now_us) {
+    if (q->count == 0) {
+        return SHIFT_QUEUE_NO_DEADLINE;
+    }
+    if (now_us >= q->next_allowed_us) {
+        return 0;
+    }
+    uint64_t wait = q->next_allowed_us - now_us;
+    return wait > UINT32_MAX - 1 ? UINT32_MAX - 1 : (uint32_t)wait;
+}
+
+/**
+ * Forget pending shifts (shifter lost), they are counted as dropped
+ */
+void shift_queue_clear(shift_queue_t *q) {
+    q->stats.dropped += (uint32_t)q->count;
+    q->head = 0;
+    q->count = 0;
+}
+
+void shift_queue_get_stats(const shift_queue_t *q, shift_queue_stats_t *stats) {
+    *stats = q->stats;
+    stats->pending = q->count;
+}
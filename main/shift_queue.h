@@ -0,0 +1,56 @@
+#ifndef SHIFT_QUEUE_H
+#define SHIFT_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "bmw_shifter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// FIFO of discrete M-mode shifts, played back one HID pulse at a time
+// Every manual gear change from bmw_process_lever_position() is pushed here, so a
+// fast double tap becomes two pulses instead of one. Shifts are released no closer
+// than pulse + gap apart, the gap guarantees the host sees a release between them.
+// Single owner: only the HID task touches the queue.
+#define SHIFT_QUEUE_LEN                16
+#define SHIFT_QUEUE_NO_DEADLINE        UINT32_MAX
+
+typedef struct {
+    uint32_t queued;             // Shifts accepted into the FIFO
+    uint32_t played;             // Shifts handed out for playback
+    uint32_t dropped;            // Shifts lost (FIFO full or cleared on disconnect)
+    size_t pending;              // Shifts waiting now
+} shift_queue_stats_t;
+
+typedef struct {
+    bmw_manual_shift_t shift;
+    int64_t origin_us;           // Time of the CAN frame that made the shift
+} shift_queue_item_t;
+
+typedef struct {
+    shift_queue_item_t items[SHIFT_QUEUE_LEN];
+    size_t head;
+    size_t count;
+    uint32_t pulse_us;           // Press length of one shift
+    uint32_t gap_us;             // Minimum release time between two shifts
+    uint64_t next_allowed_us;    // Earliest time the next shift may start
+    shift_queue_stats_t stats;
+} shift_queue_t;
+
+// Function declarations
+void shift_queue_init(shift_queue_t *q, uint32_t pulse_us, uint32_t gap_us);
+void shift_queue_set_timing(shift_queue_t *q, uint32_t pulse_us, uint32_t gap_us);
+bool shift_queue_push(shift_queue_t *q, bmw_manual_shift_t shift, int64_t origin_us);
+bool shift_queue_next(shift_queue_t *q, uint64_t now_us, shift_queue_item_t *item);
+uint32_t shift_queue_wait_us(const shift_queue_t *q, uint64_t now_us);
+void shift_queue_clear(shift_queue_t *q);
+void shift_queue_get_stats(const shift_queue_t *q, shift_queue_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIFT_QUEUE_H
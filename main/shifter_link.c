@@ -0,0 +1,64 @@
+#include "shifter_link.h"
+#include <string.h>
+#include "app_clock.h"
+#include "bmw_shifter.h"
+
+void shifter_link_init(shifter_link_t *link) {
+    memset(link, 0, sizeof(*link));
+}
+
+/**
+ * Whether a received frame goes to the serial port
+ * 0x197 always does; other IDs share one slot per SHIFTER_LINK_CAN_LOG_INTERVAL_MS.
+ */
+bool shifter_link_should_forward(shifter_link_t *link, uint32_t can_id) {
+    if (can_id == CAN_ID_GEAR_LEVER_POSITION) {
+        return true;
+    }
+    if (!app_clock_elapsed_ms(link->last_can_log_ms, SHIFTER_LINK_CAN_LOG_INTERVAL_MS)) {
+        return false;
+    }
+    link->last_can_log_ms = app_clock_now_ms();
+    return true;
+}
+
+/**
+ * Whether the shifter state is due on the serial port (after a 0x197 frame)
+ */
+bool shifter_link_should_send_state(shifter_link_t *link) {
+    if (!app_clock_elapsed_ms(link->last_state_send_ms, SHIFTER_LINK_STATE_SEND_INTERVAL_MS)) {
+        return false;
+    }
+    link->last_state_send_ms = app_clock_now_ms();
+    return true;
+}
+
+/**
+ * A frame arrived; 0x197 and 0x55E keep the shifter connected
+ * 
+ * @return true if this frame ended a silence longer than the loss timeout that
+ *         shifter_link_check_loss() did not report (counted as a loss here)
+ */
+bool shifter_link_frame_seen(shifter_link_t *link, uint32_t can_id) {
+    if (can_id != CAN_ID_GEAR_LEVER_POSITION && can_id != CAN_ID_GEAR_LEVER_HEARTBEAT) {
+        return false;
+    }
+    bool lost = shifter_link_check_loss(link);
+    link->connected = true;
+    link->last_seen_ms = app_clock_now_ms();
+    return lost;
+}
+
+/**
+ * Periodic check for a silent shifter
+ * 
+ * @return true once per loss, when a connected shifter has sent nothing for TIMING_SHIFTER_LOSS_MS
+ */
+bool shifter_link_check_loss(shifter_link_t *link) {
+    if (!link->connected || !app_clock_elapsed_ms(link->last_seen_ms, TIMING_SHIFTER_LOSS_MS)) {
+        return false;
+    }
+    link->connected = false;
+    link->losses++;
+    return true;
+}
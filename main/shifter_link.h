@@ -0,0 +1,41 @@
+#ifndef SHIFTER_LINK_H
+#define SHIFTER_LINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Timing decisions of the CAN RX path, on app_clock.h time
+// Which received frames are forwarded to the serial port (0x197 always, other IDs
+// at most once per SHIFTER_LINK_CAN_LOG_INTERVAL_MS), how often the shifter state is
+// sent, and when the shifter counts as lost (no 0x197/0x55E for TIMING_SHIFTER_LOSS_MS).
+// can_rx_task and can_replay make the same decisions through this module.
+// A loss is found by the periodic check, or by the frame that ends the silence if no
+// check ran in between (can_replay only has the frames). Not thread-safe: callers in
+// different tasks share one lock.
+#define SHIFTER_LINK_CAN_LOG_INTERVAL_MS      500   // Other IDs to the serial port, at most this often
+#define SHIFTER_LINK_STATE_SEND_INTERVAL_MS   100   // Shifter state to the serial port, at most this often
+
+typedef struct {
+    uint32_t last_can_log_ms;
+    uint32_t last_state_send_ms;
+    uint32_t last_seen_ms;       // Last 0x197/0x55E
+    bool connected;
+    uint32_t losses;             // Times the shifter went silent for longer than the timeout
+} shifter_link_t;
+
+// Function declarations
+void shifter_link_init(shifter_link_t *link);
+bool shifter_link_should_forward(shifter_link_t *link, uint32_t can_id);
+bool shifter_link_should_send_state(shifter_link_t *link);
+bool shifter_link_frame_seen(shifter_link_t *link, uint32_t can_id);
+bool shifter_link_check_loss(shifter_link_t *link);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHIFTER_LINK_H
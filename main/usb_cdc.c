@@ -0,0 +1,92 @@
+#include "usb_cdc.h"
+
+// Not built with the UART transport
+#if USB_CDC_ENABLED
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/stream_buffer.h"
+#include "tinyusb.h"
+#include "tinyusb_cdc_acm.h"
+
+#if !CFG_TUD_CDC
+#error "CDC transport needs CONFIG_TINYUSB_CDC_ENABLED (see sdkconfig.defaults) or -DSHIFTER_SERIAL_UART=ON"
+#endif
+
+static const char *TAG = "USB_CDC";
+
+// Bytes from the host, written by the TinyUSB task and read by serial_rx_task
+static StreamBufferHandle_t rx_stream = NULL;
+static volatile bool port_open = false;
+
+// Data from the host (TinyUSB task)
+static void cdc_rx_callback(int itf, cdcacm_event_t *event) {
+    uint8_t buf[CFG_TUD_CDC_EP_BUFSIZE];
+    size_t rx_size = 0;
+
+    while (tinyusb_cdcacm_read((tinyusb_cdcacm_itf_t)itf, buf, sizeof(buf), &rx_size) == ESP_OK && rx_size > 0) {
+        if (xStreamBufferSend(rx_stream, buf, rx_size, 0) != rx_size) {
+            ESP_LOGW(TAG, "RX buffer full, command bytes dropped");
+        }
+    }
+}
+
+// The app opened or closed the port (DTR)
+static void cdc_line_state_callback(int itf, cdcacm_event_t *event) {
+    port_open = event->line_state_changed_data.dtr;
+    ESP_LOGI(TAG, "Serial port %s", port_open ? "opened" : "closed");
+}
+
+/**
+ * Set up the CDC-ACM interface (after usb_hid_init installed the composite device)
+ */
+esp_err_t usb_cdc_init(void) {
+    rx_stream = xStreamBufferCreate(USB_CDC_RX_BUFFER_SIZE, 1);
+    if (rx_stream == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    const tinyusb_config_cdcacm_t acm_cfg = {
+        .cdc_port = TINYUSB_CDC_ACM_0,
+        .callback_rx = cdc_rx_callback,
+        .callback_rx_wanted_char = NULL,
+        .callback_line_state_changed = cdc_line_state_callback,
+        .callback_line_coding_changed = NULL,
+    };
+    esp_err_t ret = tinyusb_cdcacm_init(&acm_cfg);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize CDC-ACM: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    ESP_LOGI(TAG, "Serial protocol on USB CDC-ACM");
+    return ESP_OK;
+}
+
+// True while the app holds the port open
+bool usb_cdc_connected(void) {
+    return port_open && tud_mounted();
+}
+
+/**
+ * Queue data for the host and start the transfer (serial_tx_task)
+ *
+ * @return Bytes taken, less than len when the TX FIFO is full
+ */
+size_t usb_cdc_write(const uint8_t *data, size_t len) {
+    size_t queued = tinyusb_cdcacm_write_queue(TINYUSB_CDC_ACM_0, data, len);
+    if (queued > 0) {
+        tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0, 0);  // Don't wait for the host to read it
+    }
+    return queued;
+}
+
+/**
+ * Wait up to timeout_ms for data from the host and take what is buffered
+ *
+ * @return Bytes read, 0 on timeout
+ */
+size_t usb_cdc_read(uint8_t *buf, size_t len, uint32_t timeout_ms) {
+    return xStreamBufferReceive(rx_stream, buf, len, pdMS_TO_TICKS(timeout_ms));
+}
+
+#endif // USB_CDC_ENABLED
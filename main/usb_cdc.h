@@ -0,0 +1,38 @@
+#ifndef USB_CDC_H
+#define USB_CDC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Serial protocol transport, chosen at build time
+// USB CDC-ACM (default): a second interface of the composite USB device next to the
+// HID gamepad, full-speed bulk endpoints instead of 115200 baud. UART0: the original
+// link through the board's USB-UART bridge (idf.py -DSHIFTER_SERIAL_UART=ON build).
+// ESP_LOG output stays on the UART0 console either way.
+#define SERIAL_TRANSPORT_UART          0
+#define SERIAL_TRANSPORT_USB_CDC       1
+
+#ifndef SERIAL_TRANSPORT
+#define SERIAL_TRANSPORT               SERIAL_TRANSPORT_USB_CDC
+#endif
+#define USB_CDC_ENABLED                (SERIAL_TRANSPORT == SERIAL_TRANSPORT_USB_CDC)
+
+#define USB_CDC_RX_BUFFER_SIZE         512   // Received bytes waiting for serial_rx_task
+
+// Function declarations
+esp_err_t usb_cdc_init(void);
+bool usb_cdc_connected(void);
+size_t usb_cdc_write(const uint8_t *data, size_t len);
+size_t usb_cdc_read(uint8_t *buf, size_t len, uint32_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_CDC_H
@@ -1,15 +1,59 @@
 #include "usb_hid.h"
+#include "usb_cdc.h"
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "tinyusb.h"
 #include "tinyusb_default_config.h"
 #include "class/hid/hid_device.h"
+#include "device/usbd_pvt.h"  // usbd_defer_func(): private TinyUSB API, see the esp_tinyusb pin in idf_component.yml
+#include "latency_probe.h"
+#include "dlog.h"
 #include <string.h>
+#include <stdatomic.h>
 
 static const char *TAG = "USB_HID";
 
 // HID ready flag
 static bool hid_ready = false;
+static bool driver_installed = false;
+
+// Idle rate from the host's SET_IDLE, in ms (0 = report only on change)
+static volatile uint32_t idle_rate_ms = 0;
+
+// The TinyUSB task created by esp_tinyusb sleeps on its event queue. Every TinyUSB
+// call below runs in that task: other tasks queue a report and wake it with
+// usb_wake(), and service_timer wakes it for idle repeats and busy retries.
+// usbd_defer_func() waits while the USBD event queue is full, so only usb_wake_task
+// calls it: callers (esp_timer callbacks, hid_pulse under its lock) just set a request
+// bit and notify that task, which never blocks.
+#define HID_RETRY_US             1000   // Endpoint busy, try again after this long
+#define HID_REENUM_GAP_US        (20 * 1000)  // Off the bus this long before reconnecting
+#define USB_WAKE_TASK_STACK      2048
+
+// usb_wake() requests, one deferred function each (usb_wake_task)
+#define USB_WAKE_PUMP            (1u << 0)
+#define USB_WAKE_SERVICE         (1u << 1)
+#define USB_WAKE_RECONNECT       (1u << 2)
+#define USB_WAKE_POLL_INTERVAL   (1u << 3)
+
+static TaskHandle_t usb_wake_task_handle = NULL;
+static atomic_uint usb_wake_requests = 0;
+
+static esp_timer_handle_t service_timer = NULL;
+static esp_timer_handle_t reconnect_timer = NULL;
+static atomic_uint requested_poll_interval = USB_HID_POLL_INTERVAL_MS;  // Applied by the TinyUSB task
+static int64_t service_due_us = 0;
+static atomic_bool pump_scheduled = false;
+
+static void schedule_service(uint64_t delay_us);
+static void schedule_idle_repeat(void);
+static void reconnect_timer_callback(void *arg);
+static void reconnect_deferred(void *param);
+static void apply_poll_interval(void *param);
+static void usb_wake(unsigned request);
 
 // HID Gamepad Report Descriptor
 // Custom descriptor with 32 buttons support (instead of standard 16)
@@ -23,23 +67,48 @@ const uint8_t hid_report_descriptor[] = {
 // The descriptor format is compatible, we just send more button bits
 
 // String descriptors
-const char *hid_string_descriptor[5] = {
+const char *hid_string_descriptor[] = {
     // array of pointer to string descriptors
     (char[]){0x09, 0x04},  // 0: is supported language is English (0x0409)
     "BMW Shifter",         // 1: Manufacturer
     "Shifter Gamepad",     // 2: Product
     "123456",              // 3: Serials, should use chip ID
     "Gamepad Interface",   // 4: HID
+#if USB_CDC_ENABLED
+    "Shifter Serial",      // 5: CDC-ACM (serial protocol)
+#endif
+};
+
+// Interfaces: the gamepad first, so its endpoint and bInterval offset stay the same
+// with or without the CDC-ACM pair (composite device, see usb_cdc.h)
+enum {
+    ITF_NUM_HID = 0,
+#if USB_CDC_ENABLED
+    ITF_NUM_CDC,
+    ITF_NUM_CDC_DATA,
+#endif
+    ITF_NUM_TOTAL
 };
 
+#define EPNUM_HID_IN             0x81
+#define EPNUM_CDC_NOTIF          0x82
+#define EPNUM_CDC_OUT            0x03
+#define EPNUM_CDC_IN             0x83
+
 // Configuration descriptor
-#define TUSB_DESC_TOTAL_LEN      (TUD_CONFIG_DESC_LEN + CFG_TUD_HID * TUD_HID_DESC_LEN)
+#define TUSB_DESC_TOTAL_LEN      (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + USB_CDC_ENABLED * TUD_CDC_DESC_LEN)
+#define HID_EP_INTERVAL_OFFSET   (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN - 1)  // bInterval of the IN endpoint
 
-static const uint8_t hid_configuration_descriptor[] = {
+// Not const: bInterval is patched by usb_hid_set_poll_interval()
+static uint8_t hid_configuration_descriptor[] = {
     // Configuration number, interface count, string index, total length, attribute, power in mA
-    TUD_CONFIG_DESCRIPTOR(1, 1, 0, TUSB_DESC_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, TUSB_DESC_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
     // Interface number, string index, boot protocol, report descriptor len, EP In address, size & polling interval
-    TUD_HID_DESCRIPTOR(0, 4, false, sizeof(hid_report_descriptor), 0x81, CFG_TUD_HID_EP_BUFSIZE, 10),
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID, 4, false, sizeof(hid_report_descriptor), EPNUM_HID_IN, CFG_TUD_HID_EP_BUFSIZE, USB_HID_POLL_INTERVAL_MS),
+#if USB_CDC_ENABLED
+    // Interface number, string index, notification EP & size, data EPs out/in & size
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 5, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, CFG_TUD_CDC_EP_BUFSIZE),
+#endif
 };
 
 // TinyUSB HID callbacks
@@ -88,10 +157,12 @@ void tud_resume_cb(void)
     ESP_LOGI(TAG, "USB resumed");
 }
 
+// SET_IDLE: idle_rate is in 4 ms units, 0 means report only when something changes
 bool tud_hid_set_idle_cb(uint8_t instance, uint8_t idle_rate)
 {
     (void) instance;
-    (void) idle_rate;
+    idle_rate_ms = (uint32_t)idle_rate * 4;
+    schedule_idle_repeat();
     return true;
 }
 
@@ -105,14 +176,340 @@ typedef struct {
     uint32_t buttons;       // 32 buttons as bitfield (bit 0 = button 1, bit 1 = button 2, etc.)
 } __attribute__((packed)) custom_gamepad_report_t;
 
-static custom_gamepad_report_t gamepad_report = {0};
+static custom_gamepad_report_t gamepad_report = {0};  // Current state (latest change)
+
+// Report queue - every state change is queued and sent in order, one per poll.
+// The head stays queued while it is in flight and is removed by tud_hid_report_complete_cb.
+// report_lock guards the queue and gamepad_report (callers run in several tasks).
+#define HID_REPORT_QUEUE_LEN   16
+
+static custom_gamepad_report_t report_queue[HID_REPORT_QUEUE_LEN];
+static int64_t report_origin_us[HID_REPORT_QUEUE_LEN];  // CAN RX time behind a press (0 = untracked)
+static size_t queue_head = 0;
+static size_t queue_count = 0;
+static bool report_in_flight = false;
+static custom_gamepad_report_t accepted_report = {0};  // Last report the host received
+static bool accepted_report_valid = false;
+static int64_t last_report_time_us = 0;
+static usb_hid_stats_t hid_stats = {0};
+static portMUX_TYPE report_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// CAN-to-host latency: a press made while an origin is set is tagged with it, and the
+// time from the origin to the submission and to the completion of that report is recorded
+static int64_t latency_origin_us = 0;
+static latency_probe_t submit_latency = LATENCY_PROBE_INITIALIZER;
+static latency_probe_t delivery_latency = LATENCY_PROBE_INITIALIZER;
+
+// Host poll cadence, measured between completions of back-to-back reports
+// (the next one was submitted from the completion callback, so it left on the
+// very next poll). A few copies of the current state are sent after every
+// enumeration to take the first measurement. Guarded by report_lock.
+#define HID_POLL_PROBE_REPORTS 9    // Back-to-back reports sent after enumeration
+#define HID_POLL_WINDOW        8    // Samples per measurement (the shortest one wins)
+#define HID_POLL_MAX_US        (255 * 1000)
+
+static bool in_flight_chained = false;   // Report in flight was submitted from the completion callback
+static int64_t last_complete_us = 0;
+static uint32_t poll_window_min_us = UINT32_MAX;
+static uint32_t poll_window_samples = 0;
+static uint32_t poll_period_us = 0;      // Last measurement, 0 = not measured yet
+
+// Queue gamepad_report unless it repeats the previous state (report_lock held)
+// The pending tail is overwritten instead when that hides no edge: no button that
+// changed in the tail changes back in the new state.
+// Returns the queue slot holding the new state, -1 if nothing was queued.
+static int enqueue_report_locked(bool force)
+{
+    const custom_gamepad_report_t *prev = NULL;
+    if (queue_count > 0) {
+        prev = &report_queue[(queue_head + queue_count - 1) % HID_REPORT_QUEUE_LEN];
+    } else if (accepted_report_valid) {
+        prev = &accepted_report;
+    }
+    if (!force && prev != NULL && memcmp(prev, &gamepad_report, sizeof(gamepad_report)) == 0) {
+        return -1;
+    }
+    
+    size_t pending = queue_count - (report_in_flight ? 1 : 0);
+    if (!force && pending > 0) {
+        custom_gamepad_report_t *tail = &report_queue[(queue_head + queue_count - 1) % HID_REPORT_QUEUE_LEN];
+        const custom_gamepad_report_t *before = NULL;
+        if (queue_count > 1) {
+            before = &report_queue[(queue_head + queue_count - 2) % HID_REPORT_QUEUE_LEN];
+        } else if (accepted_report_valid) {
+            before = &accepted_report;
+        }
+        uint32_t tail_changes = tail->buttons ^ (before != NULL ? before->buttons : 0);
+        if ((tail_changes & (gamepad_report.buttons ^ tail->buttons)) == 0) {
+            *tail = gamepad_report;
+            hid_stats.coalesced++;
+            return (int)((queue_head + queue_count - 1) % HID_REPORT_QUEUE_LEN);
+        }
+    }
+    
+    if (queue_count == HID_REPORT_QUEUE_LEN) {
+        // Full: the newest state replaces the last pending report (an edge may be lost)
+        size_t last = (queue_head + queue_count - 1) % HID_REPORT_QUEUE_LEN;
+        report_queue[last] = gamepad_report;
+        hid_stats.overflowed++;
+        return (int)last;
+    }
+    size_t slot = (queue_head + queue_count) % HID_REPORT_QUEUE_LEN;
+    report_queue[slot] = gamepad_report;
+    report_origin_us[slot] = 0;
+    queue_count++;
+    hid_stats.queued++;
+    return (int)slot;
+}
+
+// Send the queue head if nothing is in flight (TinyUSB task)
+// chained: called from the completion callback, the report goes out on the next poll
+static void pump_reports_from(bool chained)
+{
+    custom_gamepad_report_t report;
+    bool send = false;
+    bool mounted = tud_mounted();
+    
+    portENTER_CRITICAL(&report_lock);
+    if (!mounted) {
+        // Endpoint is gone; after enumeration the host only needs the current state
+        report_in_flight = false;
+        accepted_report_valid = false;
+        queue_head = 0;
+        queue_count = 0;
+        enqueue_report_locked(false);
+    } else if (!report_in_flight && queue_count > 0) {
+        report_in_flight = true;
+        in_flight_chained = chained;
+        report = report_queue[queue_head];
+        send = true;
+    }
+    portEXIT_CRITICAL(&report_lock);
+    
+    if (!send) {
+        return;
+    }
+    // Send gamepad report using tud_hid_n_report with custom structure
+    // Report ID 1 matches the descriptor
+    // This allows us to send 32 buttons (uint32_t) instead of 16 (uint16_t)
+    if (!tud_hid_n_ready(0) || !tud_hid_n_report(0, 1, &report, sizeof(custom_gamepad_report_t))) {
+        // Endpoint still busy, the head is retried on the next completion or shortly
+        portENTER_CRITICAL(&report_lock);
+        report_in_flight = false;
+        portEXIT_CRITICAL(&report_lock);
+        schedule_service(HID_RETRY_US);
+        return;
+    }
+    
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&report_lock);
+    if (report_in_flight && report_origin_us[queue_head] != 0) {
+        latency_probe_record(&submit_latency, report_origin_us[queue_head], now);
+    }
+    portEXIT_CRITICAL(&report_lock);
+}
+
+static void pump_deferred(void *param)
+{
+    (void) param;
+    atomic_store(&pump_scheduled, false);  // Reports queued from now on need another wake-up
+    pump_reports_from(false);
+}
+
+// Wake the TinyUSB task to send what was queued (any task)
+static void pump_reports(void)
+{
+    if (driver_installed && !atomic_exchange(&pump_scheduled, true)) {
+        usb_wake(USB_WAKE_PUMP);
+    }
+}
+
+// Idle repeats and busy retries (TinyUSB task)
+static void hid_service(void *param)
+{
+    (void) param;
+    
+    // Non-zero idle rate: repeat the unchanged report once the idle period has passed
+    uint32_t idle_ms = idle_rate_ms;
+    portENTER_CRITICAL(&report_lock);
+    if (idle_ms != 0 && queue_count == 0 && accepted_report_valid &&
+        esp_timer_get_time() - last_report_time_us >= (int64_t)idle_ms * 1000) {
+        enqueue_report_locked(true);
+    }
+    portEXIT_CRITICAL(&report_lock);
+    
+    pump_reports_from(false);
+    schedule_idle_repeat();
+}
+
+// esp_timer task: hand the work to the TinyUSB task
+static void service_timer_callback(void *arg)
+{
+    (void) arg;
+    usb_wake(USB_WAKE_SERVICE);
+}
+
+// Run hid_service after delay_us, unless it is already due earlier (TinyUSB task)
+static void schedule_service(uint64_t delay_us)
+{
+    int64_t due = esp_timer_get_time() + (int64_t)delay_us;
+    if (esp_timer_is_active(service_timer) && service_due_us <= due) {
+        return;
+    }
+    esp_timer_stop(service_timer);
+    service_due_us = due;
+    esp_timer_start_once(service_timer, delay_us);
+}
+
+// Arm the next SET_IDLE repeat (TinyUSB task)
+static void schedule_idle_repeat(void)
+{
+    uint32_t idle_ms = idle_rate_ms;
+    if (idle_ms == 0) {
+        return;
+    }
+    int64_t elapsed = esp_timer_get_time() - last_report_time_us;
+    int64_t left = (int64_t)idle_ms * 1000 - elapsed;
+    schedule_service(left > 0 ? (uint64_t)left : 0);
+}
+
+// Attach/detach events from esp_tinyusb (TinyUSB task)
+static void usb_event_callback(tinyusb_event_t *event, void *arg)
+{
+    (void) arg;
+    bool attached = event->id == TINYUSB_EVENT_ATTACHED;
+    
+    portENTER_CRITICAL(&report_lock);
+    // (Re)enumerated, the host may poll at a different rate now: measure again
+    poll_period_us = 0;
+    poll_window_min_us = UINT32_MAX;
+    poll_window_samples = 0;
+    last_complete_us = 0;
+    for (int i = 0; attached && i < HID_POLL_PROBE_REPORTS; i++) {
+        enqueue_report_locked(true);
+    }
+    portEXIT_CRITICAL(&report_lock);
+    
+    ESP_LOGI(TAG, "USB %s", attached ? "attached" : "detached");
+    pump_reports_from(false);  // Sends the probe, or drops the queue when detached
+}
+
+// One poll period sample (report_lock held)
+static void add_poll_sample_locked(int64_t period_us)
+{
+    if (period_us <= 0 || period_us > HID_POLL_MAX_US) {
+        return;
+    }
+    if ((uint32_t)period_us < poll_window_min_us) {
+        poll_window_min_us = (uint32_t)period_us;
+    }
+    // A skipped poll only lengthens a sample, so the shortest of the window is the period
+    if (++poll_window_samples == HID_POLL_WINDOW) {
+        poll_period_us = poll_window_min_us;
+        poll_window_min_us = UINT32_MAX;
+        poll_window_samples = 0;
+    }
+}
+
+// Invoked when a report has been delivered to the host
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+    (void) instance;
+    (void) report;
+    (void) len;
+    
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&report_lock);
+    if (report_in_flight && queue_count > 0) {
+        accepted_report = report_queue[queue_head];
+        accepted_report_valid = true;
+        if (report_origin_us[queue_head] != 0) {
+            latency_probe_record(&delivery_latency, report_origin_us[queue_head], now);
+        }
+        queue_head = (queue_head + 1) % HID_REPORT_QUEUE_LEN;
+        queue_count--;
+        hid_stats.sent++;
+    }
+    if (report_in_flight && in_flight_chained && last_complete_us != 0) {
+        add_poll_sample_locked(now - last_complete_us);
+    }
+    report_in_flight = false;
+    last_complete_us = now;
+    last_report_time_us = now;
+    portEXIT_CRITICAL(&report_lock);
+    
+    // Next report goes out on the following poll
+    pump_reports_from(true);
+    schedule_idle_repeat();
+}
+
+// Hand pending requests to the TinyUSB task; the only caller of usbd_defer_func(),
+// so a full USBD event queue stalls nothing but this task
+static void usb_wake_task(void *arg)
+{
+    static const osal_task_func_t handlers[] = {
+        pump_deferred,          // USB_WAKE_PUMP
+        hid_service,            // USB_WAKE_SERVICE
+        reconnect_deferred,     // USB_WAKE_RECONNECT
+        apply_poll_interval,    // USB_WAKE_POLL_INTERVAL
+    };
+    (void) arg;
+    
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        unsigned requests = atomic_exchange(&usb_wake_requests, 0);
+        for (unsigned i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++) {
+            if (requests & (1u << i)) {
+                usbd_defer_func(handlers[i], NULL, false);
+            }
+        }
+    }
+}
+
+// Request a deferred function in the TinyUSB task (any task, esp_timer callbacks; never blocks)
+static void usb_wake(unsigned request)
+{
+    atomic_fetch_or(&usb_wake_requests, request);
+    xTaskNotifyGive(usb_wake_task_handle);
+}
 
-esp_err_t usb_hid_init(void)
+/**
+ * Install TinyUSB; its device task runs at task_priority on task_core (or tskNO_AFFINITY)
+ */
+esp_err_t usb_hid_init(uint8_t task_priority, int task_core)
 {
     ESP_LOGI(TAG, "Initializing USB HID Gamepad...");
     
+    const esp_timer_create_args_t service_args = {
+        .callback = service_timer_callback,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "usb_hid",
+    };
+    esp_err_t ret = esp_timer_create(&service_args, &service_timer);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    const esp_timer_create_args_t reconnect_args = {
+        .callback = reconnect_timer_callback,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "usb_hid_reenum",
+    };
+    ret = esp_timer_create(&reconnect_args, &reconnect_timer);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    
+    // Same priority and core as the TinyUSB task, so a wake-up costs one extra switch at most
+    if (xTaskCreatePinnedToCore(usb_wake_task, "usb_wake", USB_WAKE_TASK_STACK, NULL, task_priority,
+                                &usb_wake_task_handle, task_core) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    
     // Configure TinyUSB using default config
     tinyusb_config_t tusb_cfg = TINYUSB_DEFAULT_CONFIG();
+    tusb_cfg.task.priority = task_priority;
+    tusb_cfg.task.xCoreID = task_core;
+    tusb_cfg.event_cb = usb_event_callback;
     
     // Set custom descriptors
     tusb_cfg.descriptor.device = NULL; // Use default device descriptor
@@ -123,24 +520,27 @@ esp_err_t usb_hid_init(void)
     tusb_cfg.descriptor.high_speed_config = hid_configuration_descriptor;
 #endif // TUD_OPT_HIGH_SPEED
     
-    esp_err_t ret = tinyusb_driver_install(&tusb_cfg);
+    ret = tinyusb_driver_install(&tusb_cfg);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialize TinyUSB: %s", esp_err_to_name(ret));
         return ret;
     }
+    driver_installed = true;
     
     // Initialize gamepad report
     memset(&gamepad_report, 0, sizeof(custom_gamepad_report_t));
     gamepad_report.hat = 8; // Center position
     hid_ready = false;
     
-    ESP_LOGI(TAG, "USB HID Gamepad initialization started, waiting for host connection...");
+    ESP_LOGI(TAG, "USB HID Gamepad initialization started (poll interval %u ms), waiting for host connection...",
+             hid_configuration_descriptor[HID_EP_INTERVAL_OFFSET]);
     return ESP_OK;
 }
 
+// Ready once the host has configured the device; a busy endpoint is handled by the report queue
 bool usb_hid_is_ready(void)
 {
-    return tud_mounted() && tud_hid_n_ready(0);
+    return tud_mounted();
 }
 
 // Map button to gamepad button number (1-32)
@@ -160,51 +560,97 @@ static uint8_t button_to_gamepad_number(hid_button_t button)
     }
 }
 
+// Queue the current state if it changed and start sending
 esp_err_t usb_hid_send_gamepad_report(void)
 {
-    if (!usb_hid_is_ready()) {
-        ESP_LOGW(TAG, "USB HID not ready");
-        return ESP_ERR_INVALID_STATE;
-    }
+    portENTER_CRITICAL(&report_lock);
+    enqueue_report_locked(false);
+    portEXIT_CRITICAL(&report_lock);
     
-    // Send gamepad report using tud_hid_n_report with custom structure
-    // Report ID 1 matches the descriptor
-    // This allows us to send 32 buttons (uint32_t) instead of 16 (uint16_t)
-    if (!tud_hid_n_report(0, 1, &gamepad_report, sizeof(custom_gamepad_report_t))) {
-        ESP_LOGE(TAG, "Failed to send gamepad report");
-        return ESP_FAIL;
+    pump_reports();
+    return tud_mounted() ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+/**
+ * Gamepad bit (0-31) for a button, -1 if the button is not mapped
+ */
+int usb_hid_button_bit(hid_button_t button)
+{
+    uint8_t button_num = button_to_gamepad_number(button);
+    if (button_num == 0 || button_num > 32) {
+        return -1;
     }
-    
-    return ESP_OK;
+    // Button numbers are 1-32, but bitfield uses 0-31 (button 1 = bit 0, button 2 = bit 1, etc.)
+    return button_num - 1;
 }
 
-esp_err_t usb_hid_send_button(hid_button_t button, hid_action_t action)
+/**
+ * Press (pressed = true) or release every bit in mask with one report
+ */
+esp_err_t usb_hid_set_button_bits(uint32_t mask, bool pressed)
 {
-    if (!usb_hid_is_ready()) {
-        ESP_LOGW(TAG, "USB HID not ready");
-        return ESP_ERR_INVALID_STATE;
+    portENTER_CRITICAL(&report_lock);
+    bool press_edge = pressed && (mask & ~gamepad_report.buttons) != 0;
+    if (pressed) {
+        gamepad_report.buttons |= mask;
+    } else {
+        gamepad_report.buttons &= ~mask;
+    }
+    int slot = enqueue_report_locked(false);
+    // Tag the report with the CAN frame behind the press (a merged report keeps its first tag)
+    if (slot >= 0 && press_edge && latency_origin_us != 0 && report_origin_us[slot] == 0) {
+        report_origin_us[slot] = latency_origin_us;
     }
+    portEXIT_CRITICAL(&report_lock);
     
-    uint8_t button_num = button_to_gamepad_number(button);
-    if (button_num == 0 || button_num > 32) {
+    pump_reports();
+    return tud_mounted() ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+uint32_t usb_hid_get_buttons(void)
+{
+    portENTER_CRITICAL(&report_lock);
+    uint32_t buttons = gamepad_report.buttons;
+    portEXIT_CRITICAL(&report_lock);
+    return buttons;
+}
+
+esp_err_t usb_hid_send_button(hid_button_t button, hid_action_t action)
+{
+    int button_bit = usb_hid_button_bit(button);
+    if (button_bit < 0) {
         ESP_LOGE(TAG, "Invalid button: %d", button);
         return ESP_ERR_INVALID_ARG;
     }
     
-    // Button numbers are 1-32, but bitfield uses 0-31 (button 1 = bit 0, button 2 = bit 1, etc.)
-    uint8_t button_bit = button_num - 1;
-    
-    // Update gamepad report button state
     if (action == HID_ACTION_PRESS) {
-        gamepad_report.buttons |= (1UL << button_bit);
-        ESP_LOGI(TAG, "HID: Button %d pressed (bit %d)", button_num, button_bit);
+        DLOG(USB_BUTTON_PRESS, button_bit + 1, button_bit);
     } else {
-        gamepad_report.buttons &= ~(1UL << button_bit);
-        ESP_LOGI(TAG, "HID: Button %d released (bit %d)", button_num, button_bit);
+        DLOG(USB_BUTTON_RELEASE, button_bit + 1, button_bit);
     }
+    return usb_hid_set_button_bits(1UL << button_bit, action == HID_ACTION_PRESS);
+}
+
+/**
+ * Release every button with a single report
+ */
+esp_err_t usb_hid_release_all(void)
+{
+    portENTER_CRITICAL(&report_lock);
+    gamepad_report.buttons = 0;
+    enqueue_report_locked(false);
+    portEXIT_CRITICAL(&report_lock);
     
-    // Send updated report
-    return usb_hid_send_gamepad_report();
+    pump_reports();
+    return tud_mounted() ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+void usb_hid_get_stats(usb_hid_stats_t *stats)
+{
+    portENTER_CRITICAL(&report_lock);
+    *stats = hid_stats;
+    stats->pending = (uint32_t)queue_count;
+    portEXIT_CRITICAL(&report_lock);
 }
 
 esp_err_t usb_hid_send_key(uint8_t keycode, bool press)
@@ -215,9 +661,102 @@ esp_err_t usb_hid_send_key(uint8_t keycode, bool press)
     return ESP_OK;
 }
 
-// USB HID task (must be called periodically)
-void usb_hid_task(void)
+static void reconnect_deferred(void *param)
+{
+    (void) param;
+    tud_connect();
+}
+
+// esp_timer task: the gap is over, reconnect from the TinyUSB task
+static void reconnect_timer_callback(void *arg)
+{
+    (void) arg;
+    usb_wake(USB_WAKE_RECONNECT);
+}
+
+// Patch bInterval and re-enumerate so the host picks it up (TinyUSB task)
+static void apply_poll_interval(void *param)
+{
+    (void) param;
+    uint8_t interval_ms = (uint8_t)atomic_load(&requested_poll_interval);
+    if (hid_configuration_descriptor[HID_EP_INTERVAL_OFFSET] == interval_ms) {
+        return;
+    }
+    hid_configuration_descriptor[HID_EP_INTERVAL_OFFSET] = interval_ms;
+    ESP_LOGI(TAG, "HID poll interval set to %u ms", interval_ms);
+    
+    if (tud_mounted() && !esp_timer_is_active(reconnect_timer)) {
+        tud_disconnect();
+        esp_timer_start_once(reconnect_timer, HID_REENUM_GAP_US);
+    }
+}
+
+/**
+ * Set the interrupt IN polling interval (1-255 ms, any task)
+ * Before usb_hid_init() this only patches the descriptor; afterwards the TinyUSB task
+ * patches it and re-enumerates so the host picks up the new interval. Returns at once.
+ */
+esp_err_t usb_hid_set_poll_interval(uint8_t interval_ms)
+{
+    if (interval_ms == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    atomic_store(&requested_poll_interval, interval_ms);
+    if (!driver_installed) {
+        hid_configuration_descriptor[HID_EP_INTERVAL_OFFSET] = interval_ms;
+        return ESP_OK;
+    }
+    usb_wake(USB_WAKE_POLL_INTERVAL);
+    return ESP_OK;
+}
+
+uint8_t usb_hid_get_poll_interval(void)
+{
+    return (uint8_t)atomic_load(&requested_poll_interval);
+}
+
+/**
+ * Set the CAN RX time behind the presses that follow (0 = stop tagging)
+ * Only presses are tagged: releases also come from the pulse timers, which do not
+ * belong to any frame.
+ */
+void usb_hid_set_latency_origin(int64_t origin_us)
+{
+    portENTER_CRITICAL(&report_lock);
+    latency_origin_us = origin_us;
+    portEXIT_CRITICAL(&report_lock);
+}
+
+/**
+ * Copy (and optionally restart) the origin-to-submission and origin-to-delivery
+ * latency of tagged reports; either pointer may be NULL
+ */
+void usb_hid_get_latency(latency_probe_t *submitted, latency_probe_t *delivered, bool reset)
+{
+    portENTER_CRITICAL(&report_lock);
+    if (submitted != NULL) {
+        *submitted = submit_latency;
+    }
+    if (delivered != NULL) {
+        *delivered = delivery_latency;
+    }
+    if (reset) {
+        latency_probe_reset(&submit_latency);
+        latency_probe_reset(&delivery_latency);
+    }
+    portEXIT_CRITICAL(&report_lock);
+}
+
+/**
+ * Measured interval between two host polls of the IN endpoint
+ *
+ * @return Period in microseconds, 0 until a measurement completed after enumeration
+ */
+uint32_t usb_hid_get_poll_period_us(void)
 {
-    tud_task(); // TinyUSB device task - must be called frequently
+    portENTER_CRITICAL(&report_lock);
+    uint32_t period = poll_period_us;
+    portEXIT_CRITICAL(&report_lock);
+    return period;
 }
 
@@ -4,11 +4,18 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "esp_err.h"
+#include "latency_probe.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Interrupt IN polling interval in ms (1 = full-speed maximum, 1 kHz)
+// Override at build time with -DUSB_HID_POLL_INTERVAL_MS=N or at runtime with usb_hid_set_poll_interval()
+#ifndef USB_HID_POLL_INTERVAL_MS
+#define USB_HID_POLL_INTERVAL_MS       1
+#endif
+
 // HID button definitions for Gamepad
 typedef enum {
     HID_BUTTON_P = 0,      // Park (Button 0)
@@ -27,13 +34,31 @@ typedef enum {
     HID_ACTION_RELEASE = 1
 } hid_action_t;
 
+// Report queue counters
+typedef struct {
+    uint32_t queued;       // Reports added to the queue
+    uint32_t sent;         // Reports delivered to the host
+    uint32_t coalesced;    // State changes merged into a pending report (no edge lost)
+    uint32_t overflowed;   // State changes merged because the queue was full
+    uint32_t pending;      // Reports waiting, including the one in flight
+} usb_hid_stats_t;
+
 // Function declarations
-esp_err_t usb_hid_init(void);
+esp_err_t usb_hid_init(uint8_t task_priority, int task_core);
 bool usb_hid_is_ready(void);
 esp_err_t usb_hid_send_button(hid_button_t button, hid_action_t action);
+int usb_hid_button_bit(hid_button_t button);
+esp_err_t usb_hid_set_button_bits(uint32_t mask, bool pressed);
+uint32_t usb_hid_get_buttons(void);
 esp_err_t usb_hid_send_gamepad_report(void);
+esp_err_t usb_hid_release_all(void);
+void usb_hid_get_stats(usb_hid_stats_t *stats);
 esp_err_t usb_hid_send_key(uint8_t keycode, bool press); // Deprecated, use usb_hid_send_button
-void usb_hid_task(void);
+esp_err_t usb_hid_set_poll_interval(uint8_t interval_ms);
+uint8_t usb_hid_get_poll_interval(void);
+uint32_t usb_hid_get_poll_period_us(void);
+void usb_hid_set_latency_origin(int64_t origin_us);
+void usb_hid_get_latency(latency_probe_t *submitted, latency_probe_t *delivered, bool reset);
 
 #ifdef __cplusplus
 }